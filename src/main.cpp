@@ -1,5 +1,7 @@
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <optional>
 #include <vector>
 #include <utility>
 
@@ -26,7 +28,32 @@ glm::vec2 g_target_orientation{};
 
 glm::vec2 g_previous_mouse_pos{0.0f, 0.0f};
 
-std::vector<std::pair<glm::vec2, float>> g_path;
+// units are culled / LOD selected by compute shader, needs GL 4.3
+bool g_gpu_culling{};
+
+// unit circle and its arrows fit in that radius
+constexpr float UNIT_RADIUS = 1.0f;
+
+// units up to first distance from camera are drawn in full,
+// up to second with fewer vertices, farther as single point
+constexpr std::array<float, 2> LOD_DISTANCES{60.0f, 120.0f};
+constexpr unsigned UNIT_LODS = LOD_DISTANCES.size() + 1;
+
+// half size of unit sprite quad, circle glyph with its points fits in
+constexpr float SPRITE_EXTENT = 0.55f;
+
+unsigned g_path{};
+// recorded cursor trail keeps that many newest points
+constexpr unsigned PATH_CAPACITY = 1024;
+
+// covers background texture
+unsigned g_grid{};
+bool g_find_path{};
+
+// shared direction field towards target, rebuilt on click
+unsigned g_flow_field{};
+// cells integrated per frame
+constexpr unsigned FLOW_FIELD_BUDGET = 8192;
 
 glm::vec2 pp[50]{};
 
@@ -74,7 +101,9 @@ enum class ai_mode
 
     wander,
 
-    path_follow
+    path_follow,
+
+    flow_follow
 } g_ai_mode;
 
 void mouse_callback([[maybe_unused]] GLFWwindow *window, double xpos, double ypos)
@@ -100,7 +129,7 @@ void mouse_callback([[maybe_unused]] GLFWwindow *window, double xpos, double ypo
         auto const dir = g_mouse_world_pos - glm::vec3{g_previous_mouse_pos, 0.0f};
         if(glm::length(dir) > 3.0f)
         {
-            g_path.push_back({g_mouse_world_pos, atan2(dir.y, dir.x)});
+            record_path_point(g_path, g_mouse_world_pos);
             g_previous_mouse_pos = g_mouse_world_pos;
         }
     }
@@ -112,6 +141,7 @@ void mouse_click_callback([[maybe_unused]] GLFWwindow *, int button, int action,
     {
         g_target_position = g_mouse_world_pos;
         g_LMB_pressed = true;
+        set_flow_field_goal(g_flow_field, g_target_position);
     }
 
     if (button == GLFW_MOUSE_BUTTON_1 && action == GLFW_RELEASE)
@@ -136,17 +166,61 @@ void keyboard_key_callback([[maybe_unused]] GLFWwindow *window,
         break;
     case GLFW_KEY_Q:
         g_ai_mode = ai_mode::wander;
+        break;
+    case GLFW_KEY_F:
+        g_ai_mode = ai_mode::path_follow;
+        break;
+    case GLFW_KEY_G:
+        // path to target, around grid obstacles
+        g_find_path = true;
+        break;
+    case GLFW_KEY_V:
+        g_ai_mode = ai_mode::flow_follow;
+        break;
+    case GLFW_KEY_R:
+        // toggles recording of the battle
+        if (action == GLFW_PRESS && is_replay_recording())
+        {
+            if (!stop_replay())
+                std::cout << "Could not write replay.bin\n";
+        }
+        else if (action == GLFW_PRESS && !start_replay("replay.bin"))
+        {
+            std::cout << "Could not create replay.bin\n";
+        }
+        break;
+    case GLFW_KEY_T:
+        // profiled zones, open in chrome://tracing or Perfetto
+        if (action == GLFW_PRESS)
+        {
+            PROFILE_WRITE_TRACE("profile.json");
+        }
+        break;
+    case GLFW_KEY_I:
+        if (action == GLFW_PRESS)
+        {
+            PROFILE_PRINT_SUMMARY(std::cout);
+        }
+        break;
     }
 }
 
 GLFWwindow *init()
 {
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    GLFWwindow *window = glfwCreateWindow(g_window_width, g_window_height, "Musket-Meister", NULL, NULL);
+    // 4.3 for compute shader culling, 3.3 otherwise
+    GLFWwindow *window{};
+    for (auto const &[major, minor] : {std::pair{4, 3}, std::pair{3, 3}})
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, major);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minor);
+        window = glfwCreateWindow(g_window_width, g_window_height, "Musket-Meister", NULL, NULL);
+        if (window)
+            break;
+    }
+
     if (!window)
     {
         std::cout << "Failed to create GLFW window\n";
@@ -170,6 +244,11 @@ GLFWwindow *init()
         glfwTerminate();
     }
 
+    int major{}, minor{};
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    g_gpu_culling = major > 4 || (major == 4 && minor >= 3);
+
     glEnable(GL_PROGRAM_POINT_SIZE);
 
     glLineWidth(2.5f);
@@ -207,6 +286,27 @@ void set_window_title(GLFWwindow *window)
     glfwSetWindowTitle(window, window_title.c_str());
 }
 
+// Clear frames until shader programs are built, window stays responsive
+// and textures loaded meanwhile are uploaded.
+void show_loading(GLFWwindow *window)
+{
+    while (unsigned const building = poll_shaders())
+    {
+        if (glfwWindowShouldClose(window))
+            return;
+
+        std::string const title{"Musket-Meister. loading shaders, " + std::to_string(building) + " left"};
+        glfwSetWindowTitle(window, title.c_str());
+
+        update_textures();
+
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+    }
+}
+
 struct background_texture
 {
     int m_texture;
@@ -228,7 +328,7 @@ struct background_texture
     };
 
     background_texture()
-    :m_texture{load_texture("./textures/grass.jpg")},
+    :m_texture{load_texture_async("./textures/grass.jpg")},
     m_shader{"./shaders/grass_vertex.txt", "./shaders/grass_fragment.txt"}
     {
         m_buffer.fill_array_buffer(m_vertices.data(), m_vertices.size() * sizeof(float));
@@ -298,24 +398,19 @@ struct circle
     m_shader{"./shaders/unit_vertex.txt", "./shaders/unit_fragment.txt"},
     m_color{color}
     {
-        auto unit_vertixes = direction_circle();
-        shader unit_shader{"./shaders/unit_vertex.txt", "./shaders/unit_fragment.txt"};
-        m_buffer.fill_array_buffer(unit_vertixes.data(), unit_vertixes.size() * sizeof(glm::vec2));
+        m_buffer.fill_array_buffer(m_vertices.data(), m_vertices.size() * sizeof(glm::vec2));
         m_buffer.set_vertex_attrib_pointers("2");
     }
 
-    void prepare()
+    // glyph filling unit sprite, SPRITE_EXTENT from centre to its edge
+    void draw_sprite()
     {
         m_shader.use_program();
-        m_shader.set_uniform("view", g_view_matrix);
-        m_shader.set_uniform("projection", g_projection_matrix);
+        m_shader.set_uniform("view", glm::mat4{1.0f});
+        m_shader.set_uniform("projection", glm::ortho(-SPRITE_EXTENT, SPRITE_EXTENT, -SPRITE_EXTENT, SPRITE_EXTENT, -1.0f, 1.0f));
+        m_shader.set_uniform("model", glm::mat4{1.0f});
         m_shader.set_uniform("point_color", get_color(m_color));
         m_buffer.bind_vao();
-    }
-
-    void draw(glm::mat4 const &model)
-    {
-        m_shader.set_uniform("model", model);
         glDrawArrays(GL_POINTS, 0, m_vertices.size());
     }
 };
@@ -331,6 +426,11 @@ struct arrow
     color m_color;
     shader m_shader;
     vertex_buffer m_buffer;
+
+    // vertex ranges per level of detail: head and shaft, shaft only, nothing
+    std::array<unsigned, UNIT_LODS> const m_lod_first{0, 4, 0};
+    std::array<unsigned, UNIT_LODS> const m_lod_count{6, 2, 0};
+
     arrow(color color)
     :m_color{color},
     m_shader{"./shaders/line_vertex.txt", "./shaders/line_fragment.txt"}
@@ -348,10 +448,99 @@ struct arrow
         m_buffer.bind_vao();
     }
 
-    void draw(glm::mat4 const &model)
+    void draw(glm::mat4 const &model, unsigned lod = 0)
     {
+        if (m_lod_count[lod] == 0)
+            return;
+
         m_shader.set_uniform("model", model);
-        glDrawArrays(GL_LINES, 0, 6);
+        glDrawArrays(GL_LINES, m_lod_first[lod], m_lod_count[lod]);
+    }
+};
+
+// whole path as one line strip, only points added since last frame are uploaded
+struct path_line
+{
+    color m_color;
+    shader m_shader;
+    vertex_buffer m_buffer;
+    growable_buffer m_points;
+    std::vector<glm::vec2> m_staging;
+    // indices count points dropped from path front,
+    // m_base is point at start of the buffer
+    unsigned m_base{};
+    unsigned m_uploaded{};
+    unsigned m_first{};
+    unsigned m_size{};
+    unsigned m_generation{};
+
+    path_line(color color)
+    :m_color{color},
+    m_shader{"./shaders/line_vertex.txt", "./shaders/line_fragment.txt"},
+    m_points{256 * sizeof(glm::vec2)}
+    {
+        m_buffer.set_vertex_attrib_pointers("2");
+    }
+
+    void update(path_view const &path)
+    {
+        unsigned const end = path.m_dropped + path.m_size;
+
+        // cleared path, or dropped points take half of the buffer, starts over
+        if (path.m_generation != m_generation || end < m_uploaded || path.m_dropped - m_base > path.m_size)
+        {
+            m_generation = path.m_generation;
+            m_base = path.m_dropped;
+            m_uploaded = m_base;
+        }
+        m_first = path.m_dropped - m_base;
+        m_size = path.m_size;
+
+        if (path.m_size == 0)
+            return;
+
+        // last uploaded point goes again, simplification of recorded path moves it
+        unsigned const first = std::max(m_uploaded > m_base ? m_uploaded - 1 : m_base, path.m_dropped);
+
+        m_staging.clear();
+        for (unsigned i = first; i < end; ++i)
+        {
+            m_staging.push_back({path.m_x[i - path.m_dropped], path.m_y[i - path.m_dropped]});
+        }
+        m_points.write(m_staging.data(), (first - m_base) * sizeof(glm::vec2), m_staging.size() * sizeof(glm::vec2));
+        m_uploaded = end;
+    }
+
+    void prepare_and_draw()
+    {
+        m_shader.use_program();
+        m_shader.set_uniform("view", g_view_matrix);
+        m_shader.set_uniform("projection", g_projection_matrix);
+        m_shader.set_uniform("model", glm::mat4{1.0f});
+        m_shader.set_uniform("line_color", get_color(m_color));
+
+        m_buffer.bind_vao();
+        glDrawArrays(GL_LINE_STRIP, m_first, m_size);
+    }
+};
+
+// models of one army and kind, kept in memory too, only models
+// of units which moved are uploaded
+struct gpu_models
+{
+    std::vector<glm::mat4> m_models;
+    model_buffer m_buffer;
+
+    explicit gpu_models(unsigned size)
+    :m_models(size),
+    m_buffer{size}
+    {
+    }
+
+    // range of models written from offset on
+    void update(model_range range, unsigned offset = 0)
+    {
+        m_buffer.write(m_models.data(), offset + range.m_first, range.m_count);
     }
 };
 
@@ -373,14 +562,204 @@ struct army
     unsigned size() const { return m_size; }
 };
 
+// Units are textured quads, sprites of all unit types are in one atlas,
+// so units of every army are drawn by one instanced draw.
+struct unit_sprites
+{
+    enum sprite : unsigned
+    {
+        red_unit,
+        green_unit,
+        sprite_count
+    };
+
+    // pixels of sprite side
+    static constexpr unsigned SPRITE_SIZE = 32;
+
+    // layout of per instance attributes in sprite_vertex.txt
+    struct instance
+    {
+        glm::mat4 m_model;
+        float m_sprite;
+    };
+
+    texture_atlas m_atlas;
+    std::array<glm::vec4, sprite_count> m_uv;
+    std::array<float, sprite_count> m_layer;
+    shader m_shader;
+    vertex_buffer m_buffer;
+    growable_buffer m_instances;
+    std::vector<instance> m_staging;
+
+    static inline std::array<glm::vec2, 4> const m_quad{glm::vec2{-SPRITE_EXTENT, -SPRITE_EXTENT},
+                                                     glm::vec2{SPRITE_EXTENT, -SPRITE_EXTENT},
+                                                     glm::vec2{-SPRITE_EXTENT, SPRITE_EXTENT},
+                                                     glm::vec2{SPRITE_EXTENT, SPRITE_EXTENT}};
+
+    unit_sprites()
+    :m_atlas{256, 1},
+    m_shader{"./shaders/sprite_vertex.txt", "./shaders/sprite_fragment.txt"},
+    m_instances{64 * sizeof(instance)}
+    {
+        // instance buffer is bound by its constructor
+        m_buffer.set_instance_attrib_pointers(1, "44441");
+        m_buffer.fill_array_buffer(m_quad.data(), m_quad.size() * sizeof(glm::vec2));
+        m_buffer.set_vertex_attrib_pointers("2");
+    }
+
+    // glyphs drawn into atlas, once their program is built
+    void render(circle &red_circle, circle &green_circle)
+    {
+        render(red_unit, red_circle);
+        render(green_unit, green_circle);
+        m_atlas.generate_mipmaps();
+    }
+
+    void render(sprite s, circle &glyph)
+    {
+        atlas_region region;
+        if (!m_atlas.allocate(SPRITE_SIZE, SPRITE_SIZE, region))
+        {
+            std::cout << "Unit sprite does not fit in atlas\n";
+            return;
+        }
+
+        m_atlas.begin_render(region);
+        glyph.draw_sprite();
+        m_atlas.end_render();
+
+        m_uv[s] = region.m_uv;
+        m_layer[s] = float(region.m_layer);
+    }
+
+    // view, atlas and sprite regions, for sprite_vertex.txt or sprite_instanced_vertex.txt
+    void prepare(shader &program)
+    {
+        program.use_program();
+        program.set_uniform("view", g_view_matrix);
+        program.set_uniform("projection", g_projection_matrix);
+        program.set_uniform("sprite_uv", m_uv.data(), m_uv.size());
+        program.set_uniform("sprite_layer", m_layer.data(), m_layer.size());
+        program.set_uniform("extent", SPRITE_EXTENT);
+        program.set_uniform("atlas", 1u);
+        m_atlas.bind(1);
+    }
+
+    void add(glm::mat4 const *models, unsigned const *units, unsigned count, sprite s)
+    {
+        for (unsigned u = 0; u < count; ++u)
+        {
+            m_staging.push_back({models[units[u]], float(s)});
+        }
+    }
+
+    // units added since last draw
+    void draw()
+    {
+        if (m_staging.empty())
+            return;
+
+        m_instances.write(m_staging.data(), 0, m_staging.size() * sizeof(instance));
+
+        prepare(m_shader);
+        m_buffer.bind_vao();
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, m_quad.size(), m_staging.size());
+        m_staging.clear();
+    }
+};
+
+// Units drawn from visible lists built by compute shader,
+// CPU only uploads models of moved units and issues indirect draws.
+struct gpu_units
+{
+    enum glyph : unsigned
+    {
+        sprite_glyph,
+        arrow_glyph,
+        glyph_count
+    };
+
+    gpu_culling m_culling;
+    shader m_sprite_shader;
+    shader m_arrow_shader;
+    vertex_buffer m_quad;
+    // green units first, their arrows are culled with first green.size() models
+    gpu_models m_units;
+    instance_buffer m_sprites;
+    gpu_models m_green_velocity;
+    gpu_models m_green_steering_linear;
+
+    gpu_units(arrow const &unit_arrow, army const &red, army const &green)
+    :m_culling{red.size() + green.size(), UNIT_LODS, glyph_count},
+    m_sprite_shader{"./shaders/sprite_instanced_vertex.txt", "./shaders/sprite_fragment.txt"},
+    m_arrow_shader{"./shaders/instanced_vertex.txt", "./shaders/line_fragment.txt"},
+    m_units{red.size() + green.size()},
+    m_sprites{red.size() + green.size()},
+    m_green_velocity{green.size()},
+    m_green_steering_linear{green.size()}
+    {
+        m_quad.fill_array_buffer(unit_sprites::m_quad.data(), unit_sprites::m_quad.size() * sizeof(glm::vec2));
+        m_quad.set_vertex_attrib_pointers("2");
+
+        std::vector<unsigned> sprites(green.size(), unit_sprites::green_unit);
+        sprites.resize(green.size() + red.size(), unit_sprites::red_unit);
+        m_sprites.write(sprites.data(), 0, sprites.size());
+
+        for (unsigned lod = 0; lod < UNIT_LODS; ++lod)
+        {
+            // sprite mip maps take over level of detail of glyph
+            m_culling.set_glyph_lod(sprite_glyph, lod, 0, unit_sprites::m_quad.size());
+            m_culling.set_glyph_lod(arrow_glyph, lod, unit_arrow.m_lod_first[lod], unit_arrow.m_lod_count[lod]);
+        }
+    }
+
+    void draw(glm::mat4 const &view_projection, unit_sprites &sprites,
+              arrow &velocity_arrow, arrow &steering_linear_arrow, army const &red, army const &green)
+    {
+        glm::vec3 const camera = g_cam.get_camera_pos();
+
+        m_units.update(write_models_p_o(green, m_units.m_models.data()));
+        m_units.update(write_models_p_o(red, m_units.m_models.data() + green.size()), green.size());
+        m_culling.cull(m_units.m_buffer, m_units.m_models.size(), view_projection, camera, UNIT_RADIUS, LOD_DISTANCES.data());
+
+        sprites.prepare(m_sprite_shader);
+        m_sprites.bind(2);
+        m_quad.bind_vao();
+        for (unsigned lod = 0; lod < UNIT_LODS; ++lod)
+        {
+            m_culling.draw(m_sprite_shader, m_units.m_buffer, GL_TRIANGLE_STRIP, sprite_glyph, lod);
+        }
+
+        // arrows use visible lists of green units
+        m_green_velocity.update(write_models_p_v(green, m_green_velocity.m_models.data()));
+        m_green_steering_linear.update(write_models_p_sl(green, m_green_steering_linear.m_models.data()));
+        m_culling.cull(m_units.m_buffer, green.size(), view_projection, camera, UNIT_RADIUS, LOD_DISTANCES.data());
+        draw_glyph(m_arrow_shader, "line_color", velocity_arrow.m_color, velocity_arrow.m_buffer, m_green_velocity, GL_LINES, arrow_glyph);
+        draw_glyph(m_arrow_shader, "line_color", steering_linear_arrow.m_color, steering_linear_arrow.m_buffer, m_green_steering_linear, GL_LINES, arrow_glyph);
+    }
+
+    void draw_glyph(shader &program, char const *color_uniform, color c, vertex_buffer &buffer,
+                    gpu_models const &models, GLenum mode, glyph g)
+    {
+        program.use_program();
+        program.set_uniform("view", g_view_matrix);
+        program.set_uniform("projection", g_projection_matrix);
+        program.set_uniform(color_uniform, get_color(c));
+
+        buffer.bind_vao();
+        for (unsigned lod = 0; lod < UNIT_LODS; ++lod)
+        {
+            m_culling.draw(program, models.m_buffer, mode, g, lod);
+        }
+    }
+};
+
 int main()
 {
     srand(time(NULL));
 
     GLFWwindow *window = init();
 
-    set_window_title(window);
-
     background_texture background_tex;
 
     circle green_circle{color::green};
@@ -389,23 +768,48 @@ int main()
     arrow velocity_arrow{color::green};
     arrow red_steering_linear_arrow{color::red};
     arrow user_arrow{color::blue};
-    arrow path_arrow{color::orange};
+    path_line orange_path{color::orange};
+
+    unit_sprites sprites;
+
+    g_path = create_path();
+    set_path_capacity(g_path, PATH_CAPACITY);
+    g_grid = create_grid(200, 200, {-100.0f, -100.0f});
+    g_flow_field = create_flow_field(g_grid);
+    set_flow_field_goal(g_flow_field, g_target_position);
 
     // Units
     army green_army(1);
     army red_army(1);
 
+    std::optional<gpu_units> gpu_drawn_units;
+    if (g_gpu_culling)
+    {
+        gpu_drawn_units.emplace(velocity_arrow, red_army, green_army);
+    }
+
+    // all programs are submitted by now
+    show_loading(window);
+    set_window_title(window);
+    sprites.render(red_circle, green_circle);
+
+    // indices of units in view, same grouped by level of detail
+    std::vector<unsigned> visible(std::max(green_army.size(), red_army.size()));
+    std::vector<unsigned> by_lod(visible.size());
+    std::array<unsigned, UNIT_LODS + 1> lod_first{};
+
     double bt{};
     while (!glfwWindowShouldClose(window))
     {
         double ct = glfwGetTime();
         double const dt = ct - bt;
-        std::cout<<dt<<std::endl;
         bt = ct;
 
         process_input(window);
+        update_textures();
 
         g_view_matrix = g_cam.calc_view_matrix();
+        glm::mat4 const view_projection = g_projection_matrix * g_view_matrix;
 
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -414,81 +818,129 @@ int main()
         // ################### MAIN DRAWING PART ###########################
         // #################################################################
 
-        background_tex.prepare_and_draw();
-
-        switch (g_ai_mode)
         {
-        case ai_mode::kinematic_seek:
-            kinematic_seek(green_army, g_mouse_world_pos);
-            break;
-        case ai_mode::kinematic_flee:
-            kinematic_flee(green_army, g_mouse_world_pos);
-            break;
-        case ai_mode::kinematic_wander:
-            kinematic_wander(green_army);
-            break;
-        case ai_mode::kinematic_arrive:
-            kinematic_arrive(green_army, g_mouse_world_pos);
-            break;
-        case ai_mode::dynamic_seek:
-            dynamic_seek(green_army, g_mouse_world_pos);
-            break;
-        case ai_mode::dynamic_flee:
-            dynamic_flee(green_army, g_mouse_world_pos);
-            break;
-        case ai_mode::dynamic_arrive:
-            dynamic_arrive(green_army, g_target_position);
-            align(green_army, g_target_orientation);
-            break;
-        case ai_mode::velocity_match:
-            // Green army will match red army velocity
-            dyn_velocity_match(green_army, red_army.vel()[0]);
-            break;
-        case ai_mode::pursue:
-            // Green army will pursue red army
-            pursue(green_army, red_army.pos()[0], red_army.vel()[0]);
-            face(green_army, red_army.pos()[0]);
-            break;
-        case ai_mode::wander:
-            wander(green_army);
-            break;
-        case ai_mode::path_follow:
-            break;
+            PROFILE_ZONE("background");
+            PROFILE_GPU_ZONE("background");
+            background_tex.prepare_and_draw();
         }
 
-        // red army follow mouse on screen
-        dynamic_arrive(red_army, g_mouse_world_pos);
-        look_where_you_going(red_army);
-
-        update_army(green_army, 2.0f * dt);
-        update_army(red_army, 2.0f * dt);
+        if (g_find_path)
+        {
+            PROFILE_ZONE("find_path");
+            find_path(g_grid, green_army.pos()[0], g_target_position, g_path);
+            g_ai_mode = ai_mode::path_follow;
+            g_find_path = false;
+        }
 
-        glm::mat4 const *ra_models_p_o = calculate_models_p_o(red_army);
-        red_circle.prepare();
-        for (unsigned i = 0; i < red_army.size(); ++i)
         {
-            red_circle.draw(ra_models_p_o[i]);
+            PROFILE_ZONE("update_flow_field");
+            update_flow_field(g_flow_field, FLOW_FIELD_BUDGET);
         }
 
-        glm::mat4 const *ga_models_p_o = calculate_models_p_o(green_army);
-        green_circle.prepare();
-        for (unsigned i = 0; i < green_army.size(); ++i)
         {
-            green_circle.draw(ga_models_p_o[i]);
+            PROFILE_ZONE("steering");
+            switch (g_ai_mode)
+            {
+            case ai_mode::kinematic_seek:
+                kinematic_seek(green_army, g_mouse_world_pos);
+                break;
+            case ai_mode::kinematic_flee:
+                kinematic_flee(green_army, g_mouse_world_pos);
+                break;
+            case ai_mode::kinematic_wander:
+                kinematic_wander(green_army);
+                break;
+            case ai_mode::kinematic_arrive:
+                kinematic_arrive(green_army, g_mouse_world_pos);
+                break;
+            case ai_mode::dynamic_seek:
+                dynamic_seek(green_army, g_mouse_world_pos);
+                break;
+            case ai_mode::dynamic_flee:
+                dynamic_flee(green_army, g_mouse_world_pos);
+                break;
+            case ai_mode::dynamic_arrive:
+                dynamic_arrive(green_army, g_target_position);
+                align(green_army, g_target_orientation);
+                break;
+            case ai_mode::velocity_match:
+                // Green army will match red army velocity
+                dyn_velocity_match(green_army, red_army.vel()[0]);
+                break;
+            case ai_mode::pursue:
+                // Green army will pursue red army
+                pursue(green_army, red_army.pos()[0], red_army.vel()[0]);
+                face(green_army, red_army.pos()[0]);
+                break;
+            case ai_mode::wander:
+                wander(green_army);
+                break;
+            case ai_mode::path_follow:
+                follow_path(green_army, g_path);
+                look_where_you_going(green_army);
+                break;
+            case ai_mode::flow_follow:
+                follow_flow_field(green_army, g_flow_field);
+                look_where_you_going(green_army);
+                break;
+            }
+
+            // red army follow mouse on screen
+            dynamic_arrive(red_army, g_mouse_world_pos);
+            look_where_you_going(red_army);
         }
 
-        glm::mat4 const *ga_models_p_v = calculate_models_p_v(green_army);
-        velocity_arrow.prepare();
-        for (unsigned i = 0; i < green_army.size(); ++i)
         {
-            velocity_arrow.draw(ga_models_p_v[i]);
+            PROFILE_ZONE("step_world");
+            step_world(2.0f * dt);
         }
 
-        red_steering_linear_arrow.prepare();
-        glm::mat4 const *ga_models_p_sl = calculate_models_p_sl(green_army);
-        for (unsigned i = 0; i < green_army.size(); ++i)
+        if (gpu_drawn_units)
         {
-            red_steering_linear_arrow.draw(ga_models_p_sl[i]);
+            PROFILE_ZONE("gpu_units");
+            PROFILE_GPU_ZONE("gpu_units");
+            gpu_drawn_units->draw(view_projection, sprites, velocity_arrow,
+                                  red_steering_linear_arrow, red_army, green_army);
+        }
+        else
+        {
+            {
+                PROFILE_ZONE("units");
+                PROFILE_GPU_ZONE("units");
+                unsigned const ra_visible = cull_army(red_army, view_projection, UNIT_RADIUS, visible.data());
+                sprites.add(calculate_models_p_o(red_army), visible.data(), ra_visible, unit_sprites::red_unit);
+                unsigned const ga_visible = cull_army(green_army, view_projection, UNIT_RADIUS, visible.data());
+                sprites.add(calculate_models_p_o(green_army), visible.data(), ga_visible, unit_sprites::green_unit);
+                sprites.draw();
+
+                // arrows are drawn for the same visible list of green units
+                select_lod(green_army, visible.data(), ga_visible, g_cam.get_camera_pos(),
+                           LOD_DISTANCES.data(), LOD_DISTANCES.size(), by_lod.data(), lod_first.data());
+            }
+
+            {
+                PROFILE_ZONE("unit_arrows");
+                PROFILE_GPU_ZONE("unit_arrows");
+                glm::mat4 const *ga_models_p_v = calculate_models_p_v(green_army);
+                velocity_arrow.prepare();
+                for (unsigned lod = 0; lod < UNIT_LODS; ++lod)
+                {
+                    for (unsigned v = lod_first[lod]; v < lod_first[lod + 1]; ++v)
+                    {
+                        velocity_arrow.draw(ga_models_p_v[by_lod[v]], lod);
+                    }
+                }
+
+                red_steering_linear_arrow.prepare();
+                glm::mat4 const *ga_models_p_sl = calculate_models_p_sl(green_army);
+                for (unsigned lod = 0; lod < UNIT_LODS; ++lod)
+                {
+                    for (unsigned v = lod_first[lod]; v < lod_first[lod + 1]; ++v)
+                    {
+                        red_steering_linear_arrow.draw(ga_models_p_sl[by_lod[v]], lod);
+                    }
+                }
+            }
         }
 
         user_arrow.prepare();
@@ -497,18 +949,24 @@ int main()
         model = glm::rotate(model, atan2(g_target_orientation.y, g_target_orientation.x) - glm::radians(90.0f), glm::vec3{0.0f, 0.0f, 1.0f});
         user_arrow.draw(model);
 
-        path_arrow.prepare();
-        for(auto& [pos, rot] : g_path)
         {
-            glm::mat4 model{1.0f};
-            model = glm::translate(model, glm::vec3{pos, 0.0f});
-            model = glm::rotate(model, rot - glm::radians(90.0f), glm::vec3{0.0f, 0.0f, 1.0f});
-            path_arrow.draw(model);
+            PROFILE_ZONE("path");
+            PROFILE_GPU_ZONE("path");
+            orange_path.update(get_path(g_path));
+            orange_path.prepare_and_draw();
         }
 
         // #################################################################
 
-        glfwSwapBuffers(window);
+        {
+            PROFILE_ZONE("swap_buffers");
+            glfwSwapBuffers(window);
+        }
         glfwPollEvents();
+
+        PROFILE_FRAME();
     }
-}
\ No newline at end of file
+
+    // finishes replay being recorded, if any
+    stop_replay();
+}
@@ -0,0 +1,76 @@
+#ifndef ANGLE_H
+#define ANGLE_H
+
+#include <glm/glm.hpp>
+
+// Branch free angle helpers without libm calls,
+// so loops over whole armies can be vectorized.
+namespace angle
+{
+    constexpr float PI = 3.14159265f;
+    constexpr float TWO_PI = 2.0f * PI;
+    constexpr float HALF_PI = 0.5f * PI;
+    constexpr float INV_TWO_PI = 1.0f / TWO_PI;
+
+    // maps angle to [-pi, pi] interval, like std::remainder(a, 2pi).
+    // valid while |a| / 2pi fits into int
+    inline float wrap(float a)
+    {
+        float const turns = a * INV_TWO_PI;
+        float const k = static_cast<float>(static_cast<int>(turns + (turns < 0.0f ? -0.5f : 0.5f)));
+        return a - k * TWO_PI;
+    }
+
+    // max error ~2e-6 rad
+    // returns 0 for (0, 0)
+    inline float atan2(float y, float x)
+    {
+        float const ax = glm::abs(x);
+        float const ay = glm::abs(y);
+        float const mx = ax > ay ? ax : ay;
+        float const mn = ax > ay ? ay : ax;
+
+        float const a = mn / (mx > 0.0f ? mx : 1.0f);
+        float const s = a * a;
+        float r = a * (0.99997726f + s * (-0.33262347f + s * (0.19354346f + s * (-0.11643287f + s * (0.05265332f + s * -0.01172120f)))));
+
+        r = ay > ax ? HALF_PI - r : r;
+        r = x < 0.0f ? PI - r : r;
+        return y < 0.0f ? -r : r;
+    }
+
+    // max error ~5e-6 for both, any finite input wrap() accepts
+    inline void sincos(float a, float &s, float &c)
+    {
+        float x = wrap(a);
+
+        // reflect into [-pi/2, pi/2], cos changes sign there
+        float const reflected = x > HALF_PI ? PI - x : (x < -HALF_PI ? -PI - x : x);
+        float const cos_sign = reflected != x ? -1.0f : 1.0f;
+        x = reflected;
+
+        float const x2 = x * x;
+        s = x * (1.0f + x2 * (-1.0f / 6 + x2 * (1.0f / 120 + x2 * (-1.0f / 5040 + x2 * (1.0f / 362880)))));
+        c = cos_sign * (1.0f + x2 * (-1.0f / 2 + x2 * (1.0f / 24 + x2 * (-1.0f / 720 + x2 * (1.0f / 40320 + x2 * (-1.0f / 3628800))))));
+    }
+
+    inline glm::vec2 to_vec2(float a)
+    {
+        glm::vec2 v;
+        sincos(a, v.y, v.x);
+        return v;
+    }
+
+    // out[i] = {cos(angles[i]), sin(angles[i])}
+    inline void to_vec2(float const *angles, glm::vec2 *out, unsigned count)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            float s, c;
+            sincos(angles[i], s, c);
+            out[i] = {c, s};
+        }
+    }
+} // namespace angle
+
+#endif
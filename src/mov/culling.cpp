@@ -0,0 +1,147 @@
+#include <mov.h>
+
+#include <bit>
+#include <cassert>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Frustum planes cut with ground plane z = 0 where units stand,
+    // point is inside when a * x + b * y + c >= -radius for all of them.
+    struct ground_frustum
+    {
+        float m_a[6];
+        float m_b[6];
+        float m_c[6];
+    };
+
+    // planes from rows of view projection (Gribb / Hartmann),
+    // normalized so distances are in world units
+    ground_frustum ground_frustum_of(glm::mat4 const &m)
+    {
+        auto const row = [&](int r)
+        { return glm::vec4{m[0][r], m[1][r], m[2][r], m[3][r]}; };
+
+        glm::vec4 const planes[6] = {row(3) + row(0), row(3) - row(0),
+                                     row(3) + row(1), row(3) - row(1),
+                                     row(3) + row(2), row(3) - row(2)};
+
+        ground_frustum f;
+        for (unsigned i = 0; i < 6; ++i)
+        {
+            float const length = std::sqrt(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+            float const scale = length > 0.0f ? 1.0f / length : 0.0f;
+            f.m_a[i] = planes[i].x * scale;
+            f.m_b[i] = planes[i].y * scale;
+            // z = 0, plane z term drops out
+            f.m_c[i] = planes[i].w * scale;
+        }
+        return f;
+    }
+
+    // level of unit at squared distance d2, thresholds are squared
+    unsigned level_of(float const *thresholds, unsigned levels, float d2)
+    {
+        unsigned level = 0;
+        for (unsigned l = 0; l < levels; ++l)
+        {
+            level += d2 > thresholds[l];
+        }
+        return level;
+    }
+
+    bool inside(ground_frustum const &f, glm::vec2 const p, float radius)
+    {
+        bool in = true;
+        for (unsigned i = 0; i < 6; ++i)
+        {
+            in &= f.m_a[i] * p.x + f.m_b[i] * p.y + f.m_c[i] >= -radius;
+        }
+        return in;
+    }
+} // Anonymous NS
+
+unsigned cull_army(unsigned army_id, glm::mat4 const &view_projection, float radius, unsigned *visible)
+{
+    auto const f = ground_frustum_of(view_projection);
+    auto const army_size = get_army_size(army_id);
+    auto const p = get_position(army_id);
+
+    unsigned count = 0;
+    unsigned i = 0;
+
+#if defined(__SSE2__)
+    // four units at once, visible ones appended in order
+    __m128 const r = _mm_set1_ps(-radius);
+    for (; i + 4 <= army_size; i += 4)
+    {
+        // x0 y0 x1 y1 | x2 y2 x3 y3 -> x0..x3, y0..y3
+        __m128 const lo = _mm_loadu_ps(&p[i].x);
+        __m128 const hi = _mm_loadu_ps(&p[i + 2].x);
+        __m128 const x = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 const y = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+
+        __m128 in = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (unsigned k = 0; k < 6; ++k)
+        {
+            __m128 const d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(f.m_a[k]), x),
+                                                   _mm_mul_ps(_mm_set1_ps(f.m_b[k]), y)),
+                                        _mm_set1_ps(f.m_c[k]));
+            in = _mm_and_ps(in, _mm_cmpge_ps(d, r));
+        }
+
+        for (unsigned mask = _mm_movemask_ps(in); mask; mask &= mask - 1)
+        {
+            visible[count++] = i + std::countr_zero(mask);
+        }
+    }
+#endif
+
+    for (; i < army_size; ++i)
+    {
+        visible[count] = i;
+        count += inside(f, p[i], radius);
+    }
+
+    return count;
+}
+
+void select_lod(unsigned army_id, unsigned const *visible, unsigned count, glm::vec3 camera,
+                float const *distances, unsigned levels, unsigned *out, unsigned *first)
+{
+    constexpr unsigned LEVELS_MAX_SIZE = 8;
+    assert(levels < LEVELS_MAX_SIZE);
+
+    auto const p = get_position(army_id);
+
+    float thresholds[LEVELS_MAX_SIZE];
+    for (unsigned l = 0; l < levels; ++l)
+    {
+        thresholds[l] = distances[l] * distances[l];
+    }
+
+    // counting sort by level, levels are computed twice rather than stored
+    unsigned counts[LEVELS_MAX_SIZE + 1]{};
+    for (unsigned v = 0; v < count; ++v)
+    {
+        glm::vec2 const d = p[visible[v]] - glm::vec2{camera};
+        counts[level_of(thresholds, levels, d.x * d.x + d.y * d.y + camera.z * camera.z)]++;
+    }
+
+    first[0] = 0;
+    for (unsigned l = 0; l <= levels; ++l)
+    {
+        first[l + 1] = first[l] + counts[l];
+        counts[l] = first[l];
+    }
+
+    for (unsigned v = 0; v < count; ++v)
+    {
+        glm::vec2 const d = p[visible[v]] - glm::vec2{camera};
+        out[counts[level_of(thresholds, levels, d.x * d.x + d.y * d.y + camera.z * camera.z)]++] = visible[v];
+    }
+}
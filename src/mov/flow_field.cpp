@@ -0,0 +1,269 @@
+#include <mov.h>
+
+#include "grid.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    constexpr unsigned FLOW_FIELDS_MAX_SIZE = 8;
+    constexpr float UNREACHABLE = std::numeric_limits<float>::infinity();
+
+    // rows of direction field per worker thread
+    constexpr unsigned ROWS_PER_WORKER = 32;
+
+    // units aim that far ahead along the field
+    constexpr float LOOKAHEAD = 3.0f;
+
+    struct flow_field_data
+    {
+        unsigned m_grid_id;
+
+        // integration field being built, cost to goal per cell
+        std::vector<float> m_integration;
+        std::vector<open_node> m_open;
+        glm::vec2 m_goal;
+        unsigned m_generation;
+        bool m_building;
+
+        // last finished field, used by units while next one is built
+        std::vector<glm::vec2> m_direction;
+        std::vector<glm::vec2> m_next_direction;
+        glm::vec2 m_ready_goal;
+        bool m_ready;
+    };
+
+    std::array<flow_field_data, FLOW_FIELDS_MAX_SIZE> FLOW_FIELDS;
+    unsigned FLOW_FIELDS_SIZE{0};
+
+#define FLOW_FIELD_EXIST(field_id) assert(field_id < FLOW_FIELDS_SIZE)
+
+    component<glm::vec2> const FLOW_TARGET = register_component<glm::vec2>();
+
+    void start_build(flow_field_data &field)
+    {
+        auto const info = get_grid_info(field.m_grid_id);
+        unsigned const goal = cell_of(info, field.m_goal);
+
+        field.m_integration.assign(info.m_width * info.m_height, UNREACHABLE);
+        field.m_open.clear();
+
+        field.m_integration[goal] = 0.0f;
+        field.m_open.push_back({0.0f, goal});
+
+        field.m_generation = get_grid_generation(field.m_grid_id);
+        field.m_building = true;
+    }
+
+    // Dijkstra from goal, settles at most max_cells cells.
+    // returns true when whole field is integrated
+    bool integrate(flow_field_data &field, unsigned max_cells)
+    {
+        auto const info = get_grid_info(field.m_grid_id);
+        auto const cost = get_grid_costs(field.m_grid_id);
+        auto &integration = field.m_integration;
+        auto &open = field.m_open;
+
+        int const w = info.m_width;
+        int const h = info.m_height;
+        auto const walkable = [&](int x, int y)
+        { return x >= 0 && y >= 0 && x < w && y < h && cost[y * w + x] != 0; };
+
+        for (unsigned settled = 0; settled < max_cells && !open.empty();)
+        {
+            std::pop_heap(open.begin(), open.end());
+            auto const [c_cost, c] = open.back();
+            open.pop_back();
+
+            // stale entry, cell got cheaper since pushed
+            if (c_cost > integration[c])
+                continue;
+            ++settled;
+
+            int const x = c % w;
+            int const y = c / w;
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    if ((dx == 0 && dy == 0) || !walkable(x + dx, y + dy))
+                        continue;
+
+                    // same moves as path search, no cutting corners
+                    bool const diagonal = dx != 0 && dy != 0;
+                    if (diagonal && !(walkable(x + dx, y) && walkable(x, y + dy)))
+                        continue;
+
+                    // field flows backwards, unit at n pays for entering c
+                    unsigned const n = (y + dy) * w + (x + dx);
+                    float const step = (diagonal ? SQRT2 : 1.0f) * (cost[c] != 0 ? cost[c] : 1);
+                    float const n_cost = integration[c] + step;
+                    if (n_cost < integration[n])
+                    {
+                        integration[n] = n_cost;
+                        open.push_back({n_cost, n});
+                        std::push_heap(open.begin(), open.end());
+                    }
+                }
+            }
+        }
+        return open.empty();
+    }
+
+    // every cell points to its cheapest neighbour
+    void directions(flow_field_data &field, unsigned first_row, unsigned last_row)
+    {
+        auto const info = get_grid_info(field.m_grid_id);
+        auto const cost = get_grid_costs(field.m_grid_id);
+        auto const &integration = field.m_integration;
+
+        int const w = info.m_width;
+        int const h = info.m_height;
+        auto const walkable = [&](int x, int y)
+        { return x >= 0 && y >= 0 && x < w && y < h && cost[y * w + x] != 0; };
+
+        for (int y = first_row; y < int(last_row); ++y)
+        {
+            for (int x = 0; x < w; ++x)
+            {
+                unsigned const c = y * w + x;
+
+                float best = integration[c];
+                glm::vec2 dir{0.0f};
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        if ((dx == 0 && dy == 0) || !walkable(x + dx, y + dy))
+                            continue;
+                        if (dx != 0 && dy != 0 && !(walkable(x + dx, y) && walkable(x, y + dy)))
+                            continue;
+
+                        float const n = integration[(y + dy) * w + (x + dx)];
+                        if (n < best)
+                        {
+                            best = n;
+                            dir = glm::vec2{float(dx), float(dy)};
+                        }
+                    }
+                }
+
+                field.m_next_direction[c] = dir.x != 0.0f && dir.y != 0.0f ? dir * (1.0f / SQRT2) : dir;
+            }
+        }
+    }
+
+    // publishes field, direction rows are split between threads
+    void finish_build(flow_field_data &field)
+    {
+        auto const info = get_grid_info(field.m_grid_id);
+        field.m_next_direction.resize(info.m_width * info.m_height);
+
+        unsigned const hardware = std::max(std::thread::hardware_concurrency(), 1u);
+        unsigned const workers = std::clamp(info.m_height / ROWS_PER_WORKER, 1u, hardware);
+        unsigned const rows = (info.m_height + workers - 1) / workers;
+
+        std::vector<std::thread> threads;
+        for (unsigned w = 1; w < workers; ++w)
+        {
+            threads.emplace_back(directions, std::ref(field), w * rows, std::min((w + 1) * rows, info.m_height));
+        }
+        directions(field, 0, std::min(rows, info.m_height));
+
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+
+        std::swap(field.m_direction, field.m_next_direction);
+        field.m_ready_goal = field.m_goal;
+        field.m_ready = true;
+        field.m_building = false;
+    }
+} // Anonymous NS
+
+unsigned create_flow_field(unsigned grid_id)
+{
+    assert(FLOW_FIELDS_SIZE < FLOW_FIELDS_MAX_SIZE);
+
+    auto &field = FLOW_FIELDS[FLOW_FIELDS_SIZE];
+    field.m_grid_id = grid_id;
+    field.m_building = false;
+    field.m_ready = false;
+
+    return FLOW_FIELDS_SIZE++;
+}
+
+void set_flow_field_goal(unsigned field_id, glm::vec2 goal)
+{
+    FLOW_FIELD_EXIST(field_id);
+    auto &field = FLOW_FIELDS[field_id];
+
+    field.m_goal = goal;
+    start_build(field);
+}
+
+bool update_flow_field(unsigned field_id, unsigned max_cells)
+{
+    FLOW_FIELD_EXIST(field_id);
+    auto &field = FLOW_FIELDS[field_id];
+
+    // terrain changed under finished or unfinished field
+    bool const stale = field.m_generation != get_grid_generation(field.m_grid_id);
+    if ((field.m_building || field.m_ready) && stale)
+    {
+        start_build(field);
+    }
+
+    if (field.m_building && integrate(field, max_cells))
+    {
+        finish_build(field);
+    }
+
+    return !field.m_building && field.m_ready;
+}
+
+glm::vec2 sample_flow_field(unsigned field_id, glm::vec2 position)
+{
+    FLOW_FIELD_EXIST(field_id);
+    auto const &field = FLOW_FIELDS[field_id];
+
+    if (!field.m_ready)
+        return glm::vec2{0.0f};
+
+    return field.m_direction[cell_of(get_grid_info(field.m_grid_id), position)];
+}
+
+void follow_flow_field(unsigned army_id, unsigned field_id)
+{
+    FLOW_FIELD_EXIST(field_id);
+    auto const &field = FLOW_FIELDS[field_id];
+
+    if (!field.m_ready)
+        return;
+
+    auto const info = get_grid_info(field.m_grid_id);
+    unsigned const goal_cell = cell_of(info, field.m_ready_goal);
+
+    auto const army_size = get_army_size(army_id);
+    auto const p = get_position(army_id);
+    auto target = get_component(army_id, FLOW_TARGET);
+
+    for (unsigned i = 0; i < army_size; ++i)
+    {
+        unsigned const cell = cell_of(info, p[i]);
+
+        // goal cell has no direction, arrive at exact goal there,
+        // unreachable cells have none either, units stop
+        glm::vec2 const dir = field.m_direction[cell];
+        target[i] = cell == goal_cell ? field.m_ready_goal : p[i] + dir * LOOKAHEAD;
+    }
+
+    dynamic_arrive(army_id, target);
+}
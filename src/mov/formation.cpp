@@ -0,0 +1,422 @@
+#include <mov.h>
+
+#include "angle.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+namespace
+{
+    // slot offset relative to formation anchor, formation facing +y
+    component<glm::vec2> const FORMATION_OFFSET = register_component<glm::vec2>();
+
+    // per unit targets for formation_arrive
+    component<glm::vec2> const FORMATION_TARGET = register_component<glm::vec2>();
+
+    // formation space -> world space
+    struct formation_frame
+    {
+        glm::vec2 m_anchor;
+        glm::vec2 m_forward;
+        glm::vec2 m_right;
+
+        formation_frame(glm::vec2 anchor, glm::vec2 facing)
+            : m_anchor{anchor},
+              m_forward{glm::dot(facing, facing) > 0.0f ? glm::normalize(facing) : glm::vec2{0.0f, 1.0f}},
+              m_right{m_forward.y, -m_forward.x}
+        {
+        }
+
+        glm::vec2 to_world(glm::vec2 const offset) const
+        {
+            return m_anchor + offset.x * m_right + offset.y * m_forward;
+        }
+
+        glm::vec2 to_local(glm::vec2 const p) const
+        {
+            return {glm::dot(p - m_anchor, m_right), glm::dot(p - m_anchor, m_forward)};
+        }
+    };
+
+    // rows of at most `width` units, centred, going back from the front
+    void rows_slots(unsigned count, unsigned width, float spacing, float rank_spacing, glm::vec2 *out)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            unsigned const rank = i / width;
+            unsigned const file = i % width;
+            // last rank can be shorter
+            unsigned const rank_size = std::min(width, count - rank * width);
+
+            out[i] = {(file - 0.5f * (rank_size - 1)) * spacing, -(rank * rank_spacing)};
+        }
+    }
+
+    void wedge_slots(unsigned count, float spacing, unsigned ranks, float rank_spacing, glm::vec2 *out)
+    {
+        // step d is `ranks` rows of 2d + 1 units, tip in front
+        unsigned step = 0;
+        unsigned rank = 0;
+        unsigned in_row = 0;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            out[i] = {(float(in_row) - float(step)) * spacing, -((step * ranks + rank) * rank_spacing)};
+
+            if (++in_row == 2 * step + 1)
+            {
+                in_row = 0;
+                if (++rank == ranks)
+                {
+                    ++step;
+                    rank = 0;
+                }
+            }
+        }
+    }
+
+    // hollow square, `ranks` walls thick
+    void square_slots(unsigned count, float spacing, unsigned ranks, float rank_spacing, glm::vec2 *out)
+    {
+        auto const ring_size = [](unsigned side)
+        { return side > 1 ? 4 * (side - 1) : side; };
+
+        // smallest outer side which fits everyone
+        unsigned side = 1;
+        for (;; ++side)
+        {
+            unsigned capacity = 0;
+            for (unsigned r = 0; r < ranks && side > 2 * r; ++r)
+                capacity += ring_size(side - 2 * r);
+            if (capacity >= count)
+                break;
+        }
+
+        unsigned i = 0;
+        for (unsigned r = 0; r < ranks && i < count; ++r)
+        {
+            unsigned const s = side - 2 * r;
+            float const half = 0.5f * (side - 1) * spacing - r * rank_spacing;
+            float const step = s > 1 ? 2.0f * half / (s - 1) : 0.0f;
+
+            // walk the perimeter: front, right, back, left
+            for (unsigned k = 0; k < ring_size(s) && i < count; ++k, ++i)
+            {
+                unsigned const wall = s > 1 ? k / (s - 1) : 0;
+                float const t = s > 1 ? (k % (s - 1)) * step : 0.0f;
+
+                switch (wall)
+                {
+                case 0:
+                    out[i] = {-half + t, half};
+                    break;
+                case 1:
+                    out[i] = {half, half - t};
+                    break;
+                case 2:
+                    out[i] = {half - t, -half};
+                    break;
+                default:
+                    out[i] = {-half, -half + t};
+                    break;
+                }
+            }
+        }
+    }
+
+    // concentric rings, units shared proportionally to circumference
+    void circle_slots(unsigned count, float spacing, unsigned ranks, float rank_spacing, glm::vec2 *out)
+    {
+        // sum of circumferences / spacing has to fit everyone
+        float const inner_radius =
+            std::max(spacing, (count * spacing / angle::TWO_PI - rank_spacing * ranks * (ranks - 1) * 0.5f) / ranks);
+
+        float total_length = 0.0f;
+        for (unsigned r = 0; r < ranks; ++r)
+            total_length += inner_radius + r * rank_spacing;
+
+        unsigned i = 0;
+        for (unsigned r = 0; r < ranks && i < count; ++r)
+        {
+            float const radius = inner_radius + r * rank_spacing;
+            unsigned const ring_count = r + 1 == ranks
+                                            ? count - i
+                                            : std::min(count - i, unsigned(count * radius / total_length + 0.5f));
+
+            for (unsigned k = 0; k < ring_count; ++k, ++i)
+            {
+                // first unit of every ring in front
+                out[i] = radius * angle::to_vec2(angle::HALF_PI - angle::TWO_PI * k / ring_count);
+            }
+        }
+    }
+
+    // Uniform grid over slots, for nearest free slot queries.
+    struct slot_grid
+    {
+        glm::vec2 m_min;
+        float m_cell;
+        int m_width;
+        int m_height;
+        // slots of cell c are m_slots[m_start[c] .. m_start[c + 1])
+        std::vector<unsigned> m_start;
+        std::vector<unsigned> m_slots;
+        std::vector<unsigned> m_free;
+
+        void build(glm::vec2 const *slots, unsigned count, float cell)
+        {
+            glm::vec2 mn = slots[0];
+            glm::vec2 mx = slots[0];
+            for (unsigned i = 1; i < count; ++i)
+            {
+                mn = glm::min(mn, slots[i]);
+                mx = glm::max(mx, slots[i]);
+            }
+
+            m_min = mn;
+            m_cell = cell;
+            m_width = int((mx.x - mn.x) / cell) + 1;
+            m_height = int((mx.y - mn.y) / cell) + 1;
+
+            m_start.assign(m_width * m_height + 1, 0);
+            for (unsigned i = 0; i < count; ++i)
+                ++m_start[cell_of(slots[i]) + 1];
+            std::partial_sum(m_start.begin(), m_start.end(), m_start.begin());
+
+            m_free.assign(m_width * m_height, 0);
+            m_slots.resize(count);
+            for (unsigned i = 0; i < count; ++i)
+            {
+                int const c = cell_of(slots[i]);
+                m_slots[m_start[c] + m_free[c]++] = i;
+            }
+        }
+
+        int cell_x(float x) const { return std::clamp(int((x - m_min.x) / m_cell), 0, m_width - 1); }
+        int cell_y(float y) const { return std::clamp(int((y - m_min.y) / m_cell), 0, m_height - 1); }
+        int cell_of(glm::vec2 const p) const { return cell_y(p.y) * m_width + cell_x(p.x); }
+
+        // Ring search around p, rings stop once they cannot hold anything closer.
+        // Points outside are clamped into the grid, which never brings slots closer.
+        unsigned take_nearest(glm::vec2 const p, glm::vec2 const *slots, std::vector<std::uint8_t> &taken)
+        {
+            int const cx = cell_x(p.x);
+            int const cy = cell_y(p.y);
+            int const max_ring = std::max(m_width, m_height);
+
+            unsigned best = ~0u;
+            float best_d2 = 0.0f;
+            for (int r = 0; r <= max_ring; ++r)
+            {
+                float const bound = (r - 1) * m_cell;
+                if (best != ~0u && r > 0 && best_d2 <= bound * bound)
+                    break;
+
+                for (int y = std::max(cy - r, 0); y <= std::min(cy + r, m_height - 1); ++y)
+                {
+                    // inner rows only have both ends of the ring
+                    bool const edge_row = y == cy - r || y == cy + r;
+                    int const step = edge_row ? 1 : 2 * r;
+                    for (int x = cx - r; x <= cx + r; x += std::max(step, 1))
+                    {
+                        if (x < 0 || x >= m_width)
+                            continue;
+
+                        int const c = y * m_width + x;
+                        if (m_free[c] == 0)
+                            continue;
+
+                        for (unsigned k = m_start[c]; k < m_start[c + 1]; ++k)
+                        {
+                            unsigned const s = m_slots[k];
+                            if (taken[s])
+                                continue;
+
+                            glm::vec2 const d = slots[s] - p;
+                            float const d2 = glm::dot(d, d);
+                            if (best == ~0u || d2 < best_d2)
+                            {
+                                best = s;
+                                best_d2 = d2;
+                            }
+                        }
+                    }
+                }
+            }
+
+            assert(best != ~0u);
+            taken[best] = 1;
+            --m_free[cell_of(slots[best])];
+            return best;
+        }
+    };
+
+    float distance2(glm::vec2 const a, glm::vec2 const b)
+    {
+        glm::vec2 const d = a - b;
+        return glm::dot(d, d);
+    }
+} // Anonymous NS
+
+void formation_slots(formation_shape const &shape, unsigned count, glm::vec2 *out)
+{
+    unsigned const ranks = std::max(shape.m_ranks, 1u);
+
+    switch (shape.m_type)
+    {
+    case formation::line_along_x_towards_y:
+        for (unsigned i = 0; i < count; ++i)
+            out[i] = {i * shape.m_spacing, 0.0f};
+        break;
+    case formation::line:
+        rows_slots(count, (count + ranks - 1) / ranks, shape.m_spacing, shape.m_rank_spacing, out);
+        break;
+    case formation::column:
+        rows_slots(count, ranks, shape.m_spacing, shape.m_rank_spacing, out);
+        break;
+    case formation::wedge:
+        wedge_slots(count, shape.m_spacing, ranks, shape.m_rank_spacing, out);
+        break;
+    case formation::square:
+        square_slots(count, shape.m_spacing, ranks, shape.m_rank_spacing, out);
+        break;
+    case formation::circle:
+        circle_slots(count, shape.m_spacing, ranks, shape.m_rank_spacing, out);
+        break;
+    }
+}
+
+void set_formation(unsigned army_id, formation f, glm::vec2 spawn, float spacing)
+{
+    auto const army_size = get_army_size(army_id);
+    auto p = get_position(army_id);
+
+    formation_slots({f, spacing}, army_size, p);
+    for (unsigned i = 0; i < army_size; ++i)
+    {
+        p[i] += spawn;
+    }
+
+    mark_dirty(army_id);
+}
+
+void set_formation(unsigned army_id, formation_shape const &shape, glm::vec2 anchor, glm::vec2 facing)
+{
+    auto const army_size = get_army_size(army_id);
+    auto p = get_position(army_id);
+    auto o = get_orientation(army_id);
+    auto offsets = get_component(army_id, FORMATION_OFFSET);
+
+    formation_slots(shape, army_size, offsets);
+
+    formation_frame const frame{anchor, facing};
+    float const orientation = angle::atan2(frame.m_forward.y, frame.m_forward.x);
+    for (unsigned i = 0; i < army_size; ++i)
+    {
+        p[i] = frame.to_world(offsets[i]);
+        o[i] = orientation;
+    }
+
+    mark_dirty(army_id);
+}
+
+void assign_formation(unsigned army_id, formation_shape const &shape, glm::vec2 anchor, glm::vec2 facing)
+{
+    auto const army_size = get_army_size(army_id);
+    if (army_size == 0)
+        return;
+
+    auto const p = get_position(army_id);
+    auto offsets = get_component(army_id, FORMATION_OFFSET);
+
+    // scratch reused between ticks
+    static std::vector<glm::vec2> slots;
+    static std::vector<glm::vec2> units;
+    static std::vector<unsigned> order;
+    static std::vector<unsigned> unit_slot;
+    static std::vector<unsigned> slot_unit;
+    static std::vector<std::uint8_t> taken;
+    static slot_grid grid;
+
+    slots.resize(army_size);
+    formation_slots(shape, army_size, slots.data());
+
+    // Matching is done in formation space, distances are the same
+    // but slots are axis aligned there, so the grid stays tight.
+    formation_frame const frame{anchor, facing};
+    units.resize(army_size);
+    for (unsigned i = 0; i < army_size; ++i)
+        units[i] = frame.to_local(p[i]);
+
+    // few slots per cell
+    float const cell = 2.0f * std::max({shape.m_spacing, shape.m_rank_spacing, 0.01f});
+    grid.build(slots.data(), army_size, cell);
+
+    // units far from formation pick first,
+    // otherwise near units grab their slots
+    order.resize(army_size);
+    std::iota(order.begin(), order.end(), 0u);
+    std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b)
+              { return glm::dot(units[a], units[a]) > glm::dot(units[b], units[b]); });
+
+    taken.assign(army_size, 0);
+    unit_slot.resize(army_size);
+    slot_unit.resize(army_size);
+    for (unsigned const u : order)
+    {
+        unsigned const s = grid.take_nearest(units[u], slots.data(), taken);
+        unit_slot[u] = s;
+        slot_unit[s] = u;
+    }
+
+    // Greedy leaves crossing paths, swap with units of neighbouring slots
+    // whenever it shortens the total squared travel.
+    for (unsigned u = 0; u < army_size; ++u)
+    {
+        unsigned const s = unit_slot[u];
+        int const cx = grid.cell_x(slots[s].x);
+        int const cy = grid.cell_y(slots[s].y);
+
+        for (int y = std::max(cy - 1, 0); y <= std::min(cy + 1, grid.m_height - 1); ++y)
+        {
+            for (int x = std::max(cx - 1, 0); x <= std::min(cx + 1, grid.m_width - 1); ++x)
+            {
+                int const c = y * grid.m_width + x;
+                for (unsigned k = grid.m_start[c]; k < grid.m_start[c + 1]; ++k)
+                {
+                    unsigned const t = grid.m_slots[k];
+                    unsigned const v = slot_unit[t];
+                    unsigned const us = unit_slot[u];
+
+                    float const now = distance2(units[u], slots[us]) + distance2(units[v], slots[t]);
+                    float const swapped = distance2(units[u], slots[t]) + distance2(units[v], slots[us]);
+                    if (swapped < now)
+                    {
+                        unit_slot[u] = t;
+                        slot_unit[t] = u;
+                        unit_slot[v] = us;
+                        slot_unit[us] = v;
+                    }
+                }
+            }
+        }
+    }
+
+    for (unsigned u = 0; u < army_size; ++u)
+        offsets[u] = slots[unit_slot[u]];
+}
+
+void formation_arrive(unsigned army_id, glm::vec2 anchor, glm::vec2 facing)
+{
+    auto const army_size = get_army_size(army_id);
+    auto const offsets = get_component(army_id, FORMATION_OFFSET);
+    auto targets = get_component(army_id, FORMATION_TARGET);
+
+    formation_frame const frame{anchor, facing};
+    for (unsigned i = 0; i < army_size; ++i)
+        targets[i] = frame.to_world(offsets[i]);
+
+    dynamic_arrive(army_id, targets);
+}
@@ -0,0 +1,139 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <mov.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Grid internals shared by pathfinding, flow fields and path hierarchies.
+
+constexpr unsigned NO_CELL = ~0u;
+constexpr float SQRT2 = 1.41421356f;
+
+// row major, cost of cell (x, y) is at y * width + x
+std::uint8_t const *get_grid_costs(unsigned grid_id);
+
+// bumped on every cost change
+unsigned get_grid_generation(unsigned grid_id);
+
+// positions outside the grid are clamped to its border
+inline unsigned cell_of(grid_info const &info, glm::vec2 const p)
+{
+    glm::vec2 const c = (p - info.m_origin) / info.m_cell_size;
+    unsigned const x = unsigned(glm::clamp(c.x, 0.0f, float(info.m_width - 1)));
+    unsigned const y = unsigned(glm::clamp(c.y, 0.0f, float(info.m_height - 1)));
+    return y * info.m_width + x;
+}
+
+inline glm::vec2 cell_centre(grid_info const &info, unsigned cell)
+{
+    glm::vec2 const c{float(cell % info.m_width) + 0.5f, float(cell / info.m_width) + 0.5f};
+    return info.m_origin + c * info.m_cell_size;
+}
+
+// octile distance in cells
+inline float octile(grid_info const &info, unsigned a, unsigned b)
+{
+    int const dx = std::abs(int(a % info.m_width) - int(b % info.m_width));
+    int const dy = std::abs(int(a / info.m_width) - int(b / info.m_width));
+    return float(std::max(dx, dy)) + (SQRT2 - 1.0f) * float(std::min(dx, dy));
+}
+
+struct open_node
+{
+    float m_f;
+    unsigned m_cell;
+
+    // min heap
+    bool operator<(open_node const &other) const { return m_f > other.m_f; }
+};
+
+// Per worker search state, reused between searches.
+// m_g / m_parent of a cell are valid only when its stamp is current.
+struct search_scratch
+{
+    std::vector<float> m_g;
+    std::vector<unsigned> m_parent;
+    std::vector<unsigned> m_visited;
+    std::vector<unsigned> m_closed;
+    std::vector<open_node> m_open;
+    unsigned m_search;
+
+    void begin(size_t cells)
+    {
+        if (m_g.size() != cells || ++m_search == 0)
+        {
+            m_g.assign(cells, 0.0f);
+            m_parent.assign(cells, NO_CELL);
+            m_visited.assign(cells, 0);
+            m_closed.assign(cells, 0);
+            m_search = 1;
+        }
+        m_open.clear();
+    }
+
+    void relax(unsigned cell, unsigned parent, float g, float h)
+    {
+        if (m_visited[cell] == m_search && m_g[cell] <= g)
+            return;
+
+        m_visited[cell] = m_search;
+        m_g[cell] = g;
+        m_parent[cell] = parent;
+        m_open.push_back({g + h, cell});
+        std::push_heap(m_open.begin(), m_open.end());
+    }
+
+    // NO_CELL when open list is exhausted
+    unsigned pop()
+    {
+        while (!m_open.empty())
+        {
+            std::pop_heap(m_open.begin(), m_open.end());
+            unsigned const cell = m_open.back().m_cell;
+            m_open.pop_back();
+
+            if (m_closed[cell] != m_search)
+            {
+                m_closed[cell] = m_search;
+                return cell;
+            }
+        }
+        return NO_CELL;
+    }
+
+    // start ... goal, only cells where direction changes
+    void reconstruct(grid_info const &info, unsigned goal, std::vector<unsigned> &out) const
+    {
+        out.clear();
+        for (unsigned c = goal; c != NO_CELL; c = m_parent[c])
+        {
+            out.push_back(c);
+        }
+        std::reverse(out.begin(), out.end());
+
+        auto const direction = [&info](unsigned a, unsigned b)
+        {
+            int const dx = int(b % info.m_width) - int(a % info.m_width);
+            int const dy = int(b / info.m_width) - int(a / info.m_width);
+            return std::array<int, 2>{(dx > 0) - (dx < 0), (dy > 0) - (dy < 0)};
+        };
+
+        size_t kept = std::min<size_t>(out.size(), 1);
+        for (size_t i = 1; i < out.size(); ++i)
+        {
+            bool const last = i + 1 == out.size();
+            if (last || direction(out[kept - 1], out[i]) != direction(out[i], out[i + 1]))
+            {
+                out[kept++] = out[i];
+            }
+        }
+        out.resize(kept);
+    }
+};
+
+#endif
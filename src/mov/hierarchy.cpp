@@ -0,0 +1,597 @@
+#include <mov.h>
+
+#include "grid.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    constexpr unsigned HIERARCHIES_MAX_SIZE = 4;
+    constexpr float UNREACHABLE = std::numeric_limits<float>::infinity();
+
+    // border runs narrower than that get one entrance in the middle,
+    // wider ones one at each end
+    constexpr unsigned MAX_ENTRANCE_WIDTH = 6;
+
+    // below that many clusters a rebuild stays on calling thread
+    constexpr unsigned CLUSTERS_PER_WORKER = 16;
+
+    // entrance cell, linked to cells across cluster border
+    struct hierarchy_node
+    {
+        unsigned m_cell;
+        std::array<unsigned, 2> m_partner;
+        unsigned m_partners;
+    };
+
+    struct cluster_data
+    {
+        std::vector<hierarchy_node> m_nodes;
+        // cost from node i to node j inside the cluster, at i * size + j
+        std::vector<float> m_distance;
+    };
+
+    // abstract path being refined as unit walks it
+    struct route
+    {
+        // start, entrances, goal
+        std::vector<glm::vec2> m_nodes;
+        // grid level points of leg i (nodes i, i + 1), without its first point
+        std::vector<std::vector<glm::vec2>> m_legs;
+        unsigned m_passed;
+        unsigned m_refined;
+        unsigned m_refined_legs;
+        unsigned m_generation;
+    };
+
+    struct hierarchy_data
+    {
+        unsigned m_grid_id;
+        unsigned m_cluster_size;
+        unsigned m_clusters_x;
+        unsigned m_clusters_y;
+
+        // grid costs the graph was built from
+        std::vector<std::uint8_t> m_cost;
+        unsigned m_generation;
+
+        // entrance cell pairs on border with east / north neighbour,
+        // first cell lies in the cluster, second in the neighbour
+        std::vector<std::vector<std::array<unsigned, 2>>> m_east;
+        std::vector<std::vector<std::array<unsigned, 2>>> m_north;
+
+        std::vector<cluster_data> m_clusters;
+        // index into m_nodes of cell's cluster, NO_CELL - not an entrance
+        std::vector<unsigned> m_node_of_cell;
+
+        // per path id
+        std::unordered_map<unsigned, route> m_routes;
+    };
+
+    std::array<hierarchy_data, HIERARCHIES_MAX_SIZE> HIERARCHIES;
+    unsigned HIERARCHIES_SIZE{0};
+
+#define HIERARCHY_EXIST(hierarchy_id) assert(hierarchy_id < HIERARCHIES_SIZE)
+
+    struct cluster_rect
+    {
+        int m_x0;
+        int m_y0;
+        int m_x1;
+        int m_y1;
+
+        int width() const { return m_x1 - m_x0; }
+        bool contains(int x, int y) const { return x >= m_x0 && y >= m_y0 && x < m_x1 && y < m_y1; }
+    };
+
+    cluster_rect rect_of(hierarchy_data const &h, grid_info const &info, unsigned cluster)
+    {
+        int const size = h.m_cluster_size;
+        int const x0 = (cluster % h.m_clusters_x) * size;
+        int const y0 = (cluster / h.m_clusters_x) * size;
+        return {x0, y0, std::min(x0 + size, int(info.m_width)), std::min(y0 + size, int(info.m_height))};
+    }
+
+    unsigned cluster_of(hierarchy_data const &h, grid_info const &info, unsigned cell)
+    {
+        unsigned const cx = (cell % info.m_width) / h.m_cluster_size;
+        unsigned const cy = (cell / info.m_width) / h.m_cluster_size;
+        return cy * h.m_clusters_x + cx;
+    }
+
+    // Dijkstra over cells of one cluster, distances indexed by cell within rect.
+    // reverse - cost of reaching source from every cell instead
+    struct cluster_scratch
+    {
+        std::vector<float> m_distance;
+        std::vector<open_node> m_open;
+
+        void run(hierarchy_data const &h, cluster_rect const &r, unsigned source, unsigned width, bool reverse)
+        {
+            auto const &cost = h.m_cost;
+            int const w = r.width();
+            auto const local = [&r, w](int x, int y)
+            { return unsigned((y - r.m_y0) * w + (x - r.m_x0)); };
+            auto const walkable = [&](int x, int y)
+            { return r.contains(x, y) && cost[y * width + x] != 0; };
+
+            m_distance.assign(w * (r.m_y1 - r.m_y0), UNREACHABLE);
+            m_open.clear();
+
+            int const sx = source % width;
+            int const sy = source / width;
+            m_distance[local(sx, sy)] = 0.0f;
+            m_open.push_back({0.0f, source});
+
+            while (!m_open.empty())
+            {
+                std::pop_heap(m_open.begin(), m_open.end());
+                auto const [c_cost, c] = m_open.back();
+                m_open.pop_back();
+
+                int const x = c % width;
+                int const y = c / width;
+                if (c_cost > m_distance[local(x, y)])
+                    continue;
+
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        if ((dx == 0 && dy == 0) || !walkable(x + dx, y + dy))
+                            continue;
+
+                        // same moves as path search, no cutting corners
+                        bool const diagonal = dx != 0 && dy != 0;
+                        if (diagonal && !(walkable(x + dx, y) && walkable(x, y + dy)))
+                            continue;
+
+                        unsigned const n = (y + dy) * width + (x + dx);
+                        float const step = (diagonal ? SQRT2 : 1.0f) * cost[reverse ? c : n];
+                        float const n_cost = c_cost + step;
+                        auto &current = m_distance[local(x + dx, y + dy)];
+                        if (n_cost < current)
+                        {
+                            current = n_cost;
+                            m_open.push_back({n_cost, n});
+                            std::push_heap(m_open.begin(), m_open.end());
+                        }
+                    }
+                }
+            }
+        }
+
+        float distance(cluster_rect const &r, unsigned cell, unsigned width) const
+        {
+            int const x = cell % width;
+            int const y = cell / width;
+            return m_distance[(y - r.m_y0) * r.width() + (x - r.m_x0)];
+        }
+    };
+
+    // Entrances on border between two clusters, a / b step to the neighbour.
+    // (x, y) walks along border from its first cell
+    void find_entrances(hierarchy_data const &h, grid_info const &info, int x, int y, int step_x, int step_y,
+                        int a, int b, unsigned length, std::vector<std::array<unsigned, 2>> &out)
+    {
+        out.clear();
+
+        unsigned const w = info.m_width;
+        auto const open = [&](unsigned i)
+        {
+            unsigned const c = (y + step_y * int(i)) * w + (x + step_x * int(i));
+            return h.m_cost[c] != 0 && h.m_cost[c + a + b * w] != 0;
+        };
+        auto const add = [&](unsigned i)
+        {
+            unsigned const c = (y + step_y * int(i)) * w + (x + step_x * int(i));
+            out.push_back({c, c + a + b * w});
+        };
+
+        for (unsigned i = 0; i < length;)
+        {
+            if (!open(i))
+            {
+                ++i;
+                continue;
+            }
+
+            unsigned end = i;
+            while (end + 1 < length && open(end + 1))
+                ++end;
+
+            if (end - i + 1 < MAX_ENTRANCE_WIDTH)
+            {
+                add((i + end) / 2);
+            }
+            else
+            {
+                add(i);
+                add(end);
+            }
+            i = end + 1;
+        }
+    }
+
+    void build_borders(hierarchy_data &h, grid_info const &info, unsigned cluster)
+    {
+        auto const r = rect_of(h, info, cluster);
+
+        if (unsigned(r.m_x1) < info.m_width)
+            find_entrances(h, info, r.m_x1 - 1, r.m_y0, 0, 1, 1, 0, r.m_y1 - r.m_y0, h.m_east[cluster]);
+        if (unsigned(r.m_y1) < info.m_height)
+            find_entrances(h, info, r.m_x0, r.m_y1 - 1, 1, 0, 0, 1, r.m_x1 - r.m_x0, h.m_north[cluster]);
+    }
+
+    // nodes from entrances on all four borders, then costs between them
+    void build_cluster(hierarchy_data &h, grid_info const &info, unsigned cluster, cluster_scratch &s)
+    {
+        auto &data = h.m_clusters[cluster];
+        for (auto const &node : data.m_nodes)
+        {
+            h.m_node_of_cell[node.m_cell] = NO_CELL;
+        }
+        data.m_nodes.clear();
+
+        auto const add = [&](std::vector<std::array<unsigned, 2>> const &entrances, unsigned side)
+        {
+            for (auto const &e : entrances)
+            {
+                unsigned const cell = e[side];
+                unsigned &index = h.m_node_of_cell[cell];
+
+                // corner cell can be entrance of two borders
+                if (index == NO_CELL)
+                {
+                    index = unsigned(data.m_nodes.size());
+                    data.m_nodes.push_back({cell, {}, 0});
+                }
+                auto &node = data.m_nodes[index];
+                node.m_partner[node.m_partners++] = e[1 - side];
+            }
+        };
+
+        unsigned const cx = cluster % h.m_clusters_x;
+        unsigned const cy = cluster / h.m_clusters_x;
+        add(h.m_east[cluster], 0);
+        add(h.m_north[cluster], 0);
+        if (cx > 0)
+            add(h.m_east[cluster - 1], 1);
+        if (cy > 0)
+            add(h.m_north[cluster - h.m_clusters_x], 1);
+
+        auto const r = rect_of(h, info, cluster);
+        unsigned const size = unsigned(data.m_nodes.size());
+        data.m_distance.resize(size * size);
+        for (unsigned i = 0; i < size; ++i)
+        {
+            s.run(h, r, data.m_nodes[i].m_cell, info.m_width, false);
+            for (unsigned j = 0; j < size; ++j)
+            {
+                data.m_distance[i * size + j] = s.distance(r, data.m_nodes[j].m_cell, info.m_width);
+            }
+        }
+    }
+
+    // Rebuilds clusters with changed cells and their neighbours,
+    // whose entrances on shared borders can change too.
+    void sync(hierarchy_data &h)
+    {
+        unsigned const generation = get_grid_generation(h.m_grid_id);
+        if (generation == h.m_generation)
+            return;
+
+        auto const info = get_grid_info(h.m_grid_id);
+        auto const cost = get_grid_costs(h.m_grid_id);
+        unsigned const clusters = h.m_clusters_x * h.m_clusters_y;
+
+        std::vector<unsigned> changed;
+        for (unsigned k = 0; k < clusters; ++k)
+        {
+            auto const r = rect_of(h, info, k);
+            for (int y = r.m_y0; y < r.m_y1; ++y)
+            {
+                unsigned const row = y * info.m_width + r.m_x0;
+                if (std::memcmp(&h.m_cost[row], &cost[row], r.width()) != 0)
+                {
+                    changed.push_back(k);
+                    break;
+                }
+            }
+        }
+        std::copy(cost, cost + h.m_cost.size(), h.m_cost.begin());
+        h.m_generation = generation;
+
+        std::vector<std::uint8_t> affected(clusters, 0);
+        for (unsigned k : changed)
+        {
+            unsigned const cx = k % h.m_clusters_x;
+            unsigned const cy = k / h.m_clusters_x;
+
+            build_borders(h, info, k);
+            affected[k] = 1;
+            if (cx > 0)
+            {
+                build_borders(h, info, k - 1);
+                affected[k - 1] = 1;
+            }
+            if (cy > 0)
+            {
+                build_borders(h, info, k - h.m_clusters_x);
+                affected[k - h.m_clusters_x] = 1;
+            }
+            if (cx + 1 < h.m_clusters_x)
+                affected[k + 1] = 1;
+            if (cy + 1 < h.m_clusters_y)
+                affected[k + h.m_clusters_x] = 1;
+        }
+
+        std::vector<unsigned> rebuild;
+        for (unsigned k = 0; k < clusters; ++k)
+        {
+            if (affected[k])
+                rebuild.push_back(k);
+        }
+
+        // clusters only write their own nodes, rebuilt in parallel
+        unsigned const count = unsigned(rebuild.size());
+        unsigned const hardware = std::max(std::thread::hardware_concurrency(), 1u);
+        unsigned const workers = std::clamp(count / CLUSTERS_PER_WORKER, 1u, hardware);
+
+        std::atomic<unsigned> next{0};
+        auto const work = [&]()
+        {
+            cluster_scratch s;
+            for (unsigned i = next++; i < count; i = next++)
+            {
+                build_cluster(h, info, rebuild[i], s);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned w = 1; w < workers; ++w)
+        {
+            threads.emplace_back(work);
+        }
+        work();
+
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    // A* over entrances, start and goal are connected to entrances
+    // of their clusters by searches inside those clusters
+    bool abstract_search(hierarchy_data const &h, grid_info const &info, unsigned start, unsigned goal,
+                         std::vector<unsigned> &out)
+    {
+        static search_scratch s;
+        static cluster_scratch from_start;
+        static cluster_scratch to_goal;
+
+        if (h.m_cost[goal] == 0)
+            return false;
+
+        unsigned const start_cluster = cluster_of(h, info, start);
+        unsigned const goal_cluster = cluster_of(h, info, goal);
+        auto const start_rect = rect_of(h, info, start_cluster);
+        auto const goal_rect = rect_of(h, info, goal_cluster);
+        from_start.run(h, start_rect, start, info.m_width, false);
+        to_goal.run(h, goal_rect, goal, info.m_width, true);
+
+        s.begin(h.m_cost.size());
+        s.relax(start, NO_CELL, 0.0f, octile(info, start, goal));
+
+        for (unsigned c = s.pop(); c != NO_CELL; c = s.pop())
+        {
+            if (c == goal)
+            {
+                out.clear();
+                for (unsigned n = goal; n != NO_CELL; n = s.m_parent[n])
+                {
+                    out.push_back(n);
+                }
+                std::reverse(out.begin(), out.end());
+                return true;
+            }
+
+            float const g = s.m_g[c];
+            unsigned const cluster = cluster_of(h, info, c);
+            auto const &data = h.m_clusters[cluster];
+            unsigned const size = unsigned(data.m_nodes.size());
+
+            if (c == start)
+            {
+                for (auto const &node : data.m_nodes)
+                {
+                    float const d = from_start.distance(start_rect, node.m_cell, info.m_width);
+                    if (d != UNREACHABLE)
+                        s.relax(node.m_cell, c, g + d, octile(info, node.m_cell, goal));
+                }
+            }
+
+            unsigned const i = h.m_node_of_cell[c];
+            if (i != NO_CELL)
+            {
+                auto const &node = data.m_nodes[i];
+                for (unsigned p = 0; p < node.m_partners; ++p)
+                {
+                    unsigned const n = node.m_partner[p];
+                    s.relax(n, c, g + h.m_cost[n], octile(info, n, goal));
+                }
+
+                // start reached its cluster's entrances already
+                for (unsigned j = 0; j < size && c != start; ++j)
+                {
+                    float const d = data.m_distance[i * size + j];
+                    if (d != UNREACHABLE)
+                        s.relax(data.m_nodes[j].m_cell, c, g + d, octile(info, data.m_nodes[j].m_cell, goal));
+                }
+            }
+
+            if (cluster == goal_cluster)
+            {
+                float const d = to_goal.distance(goal_rect, c, info.m_width);
+                if (d != UNREACHABLE)
+                    s.relax(goal, c, g + d, 0.0f);
+            }
+        }
+        return false;
+    }
+
+    void write_path(route const &r, unsigned path_id)
+    {
+        clear_path(path_id);
+        add_path_point(path_id, r.m_nodes[r.m_passed]);
+
+        for (unsigned leg = r.m_passed; leg < r.m_refined; ++leg)
+        {
+            for (auto const point : r.m_legs[leg])
+            {
+                add_path_point(path_id, point);
+            }
+        }
+        for (size_t n = r.m_refined + 1; n < r.m_nodes.size(); ++n)
+        {
+            add_path_point(path_id, r.m_nodes[n]);
+        }
+    }
+
+    // grid level paths for legs up to refined_legs past the passed node
+    void refine(hierarchy_data const &h, route &r)
+    {
+        unsigned const legs = unsigned(r.m_nodes.size() - 1);
+        unsigned const last = std::min(r.m_passed + r.m_refined_legs, legs);
+        if (r.m_refined >= last)
+            return;
+
+        static std::vector<path_query> queries;
+        queries.clear();
+        for (unsigned leg = r.m_refined; leg < last; ++leg)
+        {
+            queries.push_back({r.m_nodes[leg], r.m_nodes[leg + 1]});
+        }
+
+        // legs stay inside one or two clusters, these searches are short
+        path_batch const batch = find_paths(h.m_grid_id, queries.data(), unsigned(queries.size()));
+        for (unsigned q = 0; q < batch.m_size; ++q)
+        {
+            auto &points = r.m_legs[r.m_refined + q];
+            points.assign(batch.m_points + batch.m_offsets[q], batch.m_points + batch.m_offsets[q + 1]);
+
+            // cannot happen on a consistent graph, keep the straight line
+            if (points.empty())
+                points.push_back(queries[q].m_goal);
+        }
+        r.m_refined = last;
+    }
+} // Anonymous NS
+
+unsigned create_path_hierarchy(unsigned grid_id, unsigned cluster_size)
+{
+    assert(HIERARCHIES_SIZE < HIERARCHIES_MAX_SIZE);
+    assert(cluster_size > 1);
+
+    auto const info = get_grid_info(grid_id);
+    auto &h = HIERARCHIES[HIERARCHIES_SIZE];
+    h.m_grid_id = grid_id;
+    h.m_cluster_size = cluster_size;
+    h.m_clusters_x = (info.m_width + cluster_size - 1) / cluster_size;
+    h.m_clusters_y = (info.m_height + cluster_size - 1) / cluster_size;
+
+    unsigned const clusters = h.m_clusters_x * h.m_clusters_y;
+    h.m_east.resize(clusters);
+    h.m_north.resize(clusters);
+    h.m_clusters.resize(clusters);
+    h.m_node_of_cell.assign(info.m_width * info.m_height, NO_CELL);
+
+    // every cluster differs from blocked snapshot, whole graph is built
+    h.m_cost.assign(info.m_width * info.m_height, 0);
+    h.m_generation = get_grid_generation(grid_id) - 1;
+    sync(h);
+
+    return HIERARCHIES_SIZE++;
+}
+
+bool find_hierarchical_path(unsigned hierarchy_id, glm::vec2 start, glm::vec2 goal, unsigned path_id,
+                            unsigned refined_legs)
+{
+    HIERARCHY_EXIST(hierarchy_id);
+    assert(refined_legs > 0);
+    auto &h = HIERARCHIES[hierarchy_id];
+    sync(h);
+
+    auto const info = get_grid_info(h.m_grid_id);
+    unsigned const start_cell = cell_of(info, start);
+    unsigned const goal_cell = cell_of(info, goal);
+
+    static std::vector<unsigned> cells;
+    if (!abstract_search(h, info, start_cell, goal_cell, cells))
+    {
+        h.m_routes.erase(path_id);
+        clear_path(path_id);
+        return false;
+    }
+
+    auto &r = h.m_routes[path_id];
+    r.m_nodes.clear();
+    r.m_nodes.push_back(start);
+    for (size_t i = 1; i + 1 < cells.size(); ++i)
+    {
+        r.m_nodes.push_back(cell_centre(info, cells[i]));
+    }
+    r.m_nodes.push_back(goal);
+
+    r.m_legs.resize(r.m_nodes.size() - 1);
+    r.m_passed = 0;
+    r.m_refined = 0;
+    r.m_refined_legs = refined_legs;
+    r.m_generation = h.m_generation;
+
+    refine(h, r);
+    write_path(r, path_id);
+    return true;
+}
+
+void refine_hierarchical_path(unsigned hierarchy_id, unsigned path_id, glm::vec2 position)
+{
+    HIERARCHY_EXIST(hierarchy_id);
+    auto &h = HIERARCHIES[hierarchy_id];
+
+    auto const it = h.m_routes.find(path_id);
+    if (it == h.m_routes.end())
+        return;
+    auto &r = it->second;
+
+    // terrain changed, plan again from where unit is
+    if (r.m_generation != get_grid_generation(h.m_grid_id))
+    {
+        glm::vec2 const goal = r.m_nodes.back();
+        find_hierarchical_path(hierarchy_id, position, goal, path_id, r.m_refined_legs);
+        return;
+    }
+
+    // entrances lie on cluster borders, unit passing one gets close to it
+    auto const info = get_grid_info(h.m_grid_id);
+    float const reach = 0.5f * float(h.m_cluster_size) * info.m_cell_size;
+    auto const unit_passed = r.m_passed;
+    while (r.m_passed + 2 < r.m_nodes.size() && glm::length(position - r.m_nodes[r.m_passed + 1]) < reach)
+    {
+        ++r.m_passed;
+    }
+    if (r.m_passed == unit_passed)
+        return;
+
+    refine(h, r);
+    write_path(r, path_id);
+}
@@ -1,19 +1,167 @@
 #ifndef MOV_H
 #define MOV_H
 
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <tuple>
+#include <utility>
+
 #include <glm/glm.hpp>
 
 enum class formation
 {
-    line_along_x_towards_y
+    line_along_x_towards_y,
+    line,
+    column,
+    wedge,
+    square,
+    circle
+};
+
+// Formation in its own space, facing +y, anchored at
+// line, column : middle of the front rank
+// wedge        : tip
+// square       : centre of hollow square
+// circle       : centre
+struct formation_shape
+{
+    formation m_type;
+    // distance between neighbours in a rank
+    float m_spacing{1.0f};
+    // line        : ranks behind the front
+    // wedge       : ranks deep every step of the wedge
+    // column      : units abreast
+    // square      : thickness of the walls
+    // circle      : concentric rings
+    unsigned m_ranks{1};
+    // distance between ranks
+    float m_rank_spacing{1.0f};
 };
 
 unsigned create_army(unsigned size);
 
+// All armies are laid out in one allocation, ids are consecutive,
+// returns id of the first one. Aborts when they do not fit in the arena
+// (64 MiB, 512 MiB with MOV_LARGE_ARENA).
+unsigned create_armies(std::span<unsigned const> sizes);
+
+unsigned get_army_size(unsigned army_id);
+
+unsigned get_army_count();
+
+// Per unit column, one contiguous and cache line aligned array per army.
+// Register once (e.g. at namespace scope), then every army gets its own
+// array of that type, zero initialized.
+template <typename T>
+struct component
+{
+    unsigned m_id;
+};
+
+unsigned register_component(size_t element_size, size_t alignment);
+
+void *get_component(unsigned army_id, unsigned component_id);
+
+template <typename T>
+component<T> register_component()
+{
+    return {register_component(sizeof(T), alignof(T))};
+}
+
+template <typename T>
+T *get_component(unsigned army_id, component<T> c)
+{
+    return static_cast<T *>(get_component(army_id, c.m_id));
+}
+
+// Calls f(col_0[i], col_1[i], ...) for every unit of the army.
+// Columns are fetched once, so the loop runs over plain arrays.
+template <typename F, typename... Ts>
+void for_each_unit(unsigned army_id, F &&f, component<Ts>... columns)
+{
+    auto const army_size = get_army_size(army_id);
+    std::tuple<Ts *...> const data{get_component(army_id, columns)...};
+
+    for (unsigned i = 0; i < army_size; ++i)
+    {
+        std::apply([&](Ts *...c)
+                   { f(c[i]...); },
+                   data);
+    }
+}
+
 void set_formation(unsigned army_id, formation f, glm::vec2 spawn, float spacing = 1.0f);
 
+// places units directly in their slots, facing given direction
+void set_formation(unsigned army_id, formation_shape const &shape, glm::vec2 anchor, glm::vec2 facing = {0.0f, 1.0f});
+
+// slot offsets relative to anchor, formation facing +y
+void formation_slots(formation_shape const &shape, unsigned count, glm::vec2 *out);
+
+// Assigns every unit to a slot of formation placed at anchor / facing,
+// minimising travel (greedy over grid of slots + local swaps).
+// Cheap enough to re-form whole regiments every tick.
+void assign_formation(unsigned army_id, formation_shape const &shape, glm::vec2 anchor, glm::vec2 facing);
+
+// dynamic arrive of every unit at its assigned slot,
+// slots follow formation anchor / facing
+void formation_arrive(unsigned army_id, glm::vec2 anchor, glm::vec2 facing);
+
 void update_army(unsigned army_id, float dt);
 
+// update_army for every army, armies created together are swept as one
+// array. Work is split between workers threads, 0 - one per core
+void step_world(float dt, unsigned workers = 1);
+
+// Simulation is deterministic: same inputs give bit identical state for
+// any number of workers. Random numbers (wander) come from a generator
+// per unit, seeded from this seed and army / unit index.
+void set_random_seed(std::uint64_t seed);
+// Hash of all army columns except those derived for rendering.
+// Peers in lockstep compare it every tick to catch divergence.
+std::uint64_t hash_world();
+
+// Binary snapshot of all armies: header, component / army tables and
+// then all columns laid out like one create_armies block.
+// Loading maps the file and units live in the mapping (copy on write),
+// it replaces all armies. Snapshots fit the build that saved them.
+bool save_snapshot(char const *file_name);
+bool load_snapshot(char const *file_name);
+
+// Replay of unit positions / orientations, step_world records a tick
+// while a replay is being written. Ticks are quantized and stored as
+// varint deltas to the tick before, with a keyframe every
+// keyframe_interval ticks. Encoding and writing run on a background
+// thread, recording waits when it falls behind by more than a few ticks.
+bool start_replay(char const *file_name, unsigned keyframe_interval = 600);
+void record_replay_tick();
+// false when nothing was written or any write failed, recording is over either way
+bool stop_replay();
+bool is_replay_recording();
+
+struct replay_frame
+{
+    unsigned m_tick;
+    unsigned m_armies;
+    // units of army a are [m_offsets[a], m_offsets[a + 1])
+    unsigned const *m_offsets;
+    glm::vec2 const *m_position;
+    float const *m_orientation;
+};
+
+// Reader is positioned at the first tick after open. Replays cut short
+// (no index at the end) are readable up to their last whole frame.
+bool open_replay(char const *file_name);
+void close_replay();
+unsigned get_replay_keyframe_count();
+unsigned get_replay_keyframe_tick(unsigned keyframe);
+// decodes from the closest keyframe before tick
+bool seek_replay(unsigned tick);
+bool next_replay_tick();
+// valid until the reader moves
+replay_frame get_replay_frame();
+
 // Default : translate by position
 //           rotate    by orientation
 glm::mat4* calculate_models_p_o(unsigned army_id, float rotation_offset = 90.0f);
@@ -26,6 +174,40 @@ glm::mat4* calculate_models_p_v(unsigned army_id, float rotation_offset = 90.0f)
 // rotate    by steering linear
 glm::mat4* calculate_models_p_sl(unsigned army_id, float rotation_offset = 90.0f);
 
+// Models are recalculated only for units which moved since last call
+// (marked by update_army), returned range covers all written models.
+struct model_range
+{
+    unsigned m_first;
+    unsigned m_count;
+};
+
+// Same as above but written to out (e.g. persistently mapped GPU buffer)
+// with non-temporal stores. out has to hold get_army_size(army_id) models
+// and keep them between calls, only dirty models are overwritten.
+// Dirty units are tracked for one destination per army and model kind
+// (calculate_models_* write to their own), writing to another one
+// rewrites all models, so alternating destinations gets no savings.
+model_range write_models_p_o(unsigned army_id, glm::mat4* out, float rotation_offset = 90.0f);
+model_range write_models_p_v(unsigned army_id, glm::mat4* out, float rotation_offset = 90.0f);
+model_range write_models_p_sl(unsigned army_id, glm::mat4* out, float rotation_offset = 90.0f);
+
+// Frustum culling of units standing on ground plane z = 0.
+// Writes indices of units whose circle of radius may be seen into visible,
+// in order, returns their count. visible has to hold get_army_size(army_id).
+unsigned cull_army(unsigned army_id, glm::mat4 const &view_projection, float radius, unsigned *visible);
+
+// Groups units (e.g. culled ones) by level of detail. Level l is used up to
+// distances[l] from camera, farther units get level `levels`.
+// Units of level l are out[first[l]] .. out[first[l + 1]],
+// out holds count indices, first levels + 2 entries.
+void select_lod(unsigned army_id, unsigned const *visible, unsigned count, glm::vec3 camera,
+                float const *distances, unsigned levels, unsigned *out, unsigned *first);
+
+// Call after writing positions / orientations directly,
+// all models are recalculated on next calculate_models_*.
+void mark_dirty(unsigned army_id);
+
 glm::vec2* get_position(unsigned army_id);
 float* get_orientation(unsigned army_id);
 glm::vec2* get_steering_linear(unsigned army_id);
@@ -41,6 +223,8 @@ void kinematic_wander(unsigned army_id);
 void dynamic_seek(unsigned army_id, glm::vec2 target_pos);
 void dynamic_flee(unsigned army_id, glm::vec2 target_pos);
 void dynamic_arrive(unsigned army_id, glm::vec2 target_pos);
+// target per unit
+void dynamic_arrive(unsigned army_id, glm::vec2 const *target_pos);
 
 void pursue(unsigned army_id, glm::vec2 target_pos, glm::vec2 target_velocity);
 
@@ -58,4 +242,119 @@ void look_where_you_going(unsigned army_id);
 
 void wander(unsigned army_id);
 
+// Polyline kept as separate x / y arrays with arc length
+// from path start precomputed for every point.
+// Bounded path drops its oldest points, arc length counts from a point at
+// or before the first one kept, it is rebased when dropped points are
+// compacted away, so distances are compared within one path_view only.
+struct path_view
+{
+    float const *m_x;
+    float const *m_y;
+    float const *m_length;
+    unsigned m_size;
+    // changes when path is cleared
+    unsigned m_generation;
+    // points dropped from the front since clear
+    unsigned m_dropped;
+};
+
+unsigned create_path();
+void add_path_point(unsigned path_id, glm::vec2 point);
+void clear_path(unsigned path_id);
+// path keeps at most capacity newest points, 0 - no limit
+void set_path_capacity(unsigned path_id, unsigned capacity);
+// For recording, e.g. cursor trail. Point replaces the last one when the last
+// one, and the points it replaced, lie within tolerance of the segment from
+// point before it to new point (opening window simplification).
+// Last point of a path can change, points before it are only dropped.
+void record_path_point(unsigned path_id, glm::vec2 point, float tolerance = 0.25f);
+path_view get_path(unsigned path_id);
+float get_path_length(unsigned path_id);
+
+// Queries search only a few segments around segment_hint and update it,
+// so a caller moving along the path pays O(1) per query.
+// returns distance along the path of point closest to position
+float get_path_param(unsigned path_id, glm::vec2 position, unsigned &segment_hint);
+// returns point at given distance along the path
+glm::vec2 get_path_position(unsigned path_id, float distance, unsigned &segment_hint);
+
+// every unit arrives at point path_offset ahead of its place on the path
+void follow_path(unsigned army_id, unsigned path_id, float path_offset = 3.0f);
+
+// Cost grid for pathfinding, cell (0, 0) starts at origin.
+// Cost is paid for entering a cell, 0 - blocked, new grid costs 1 everywhere.
+struct grid_info
+{
+    unsigned m_width;
+    unsigned m_height;
+    glm::vec2 m_origin;
+    float m_cell_size;
+};
+
+unsigned create_grid(unsigned width, unsigned height, glm::vec2 origin, float cell_size = 1.0f);
+grid_info get_grid_info(unsigned grid_id);
+void set_cell_cost(unsigned grid_id, unsigned x, unsigned y, std::uint8_t cost);
+std::uint8_t get_cell_cost(unsigned grid_id, unsigned x, unsigned y);
+
+enum class path_search
+{
+    a_star,
+    // falls back to a_star on grids with costs other than 0 / 1
+    jps
+};
+
+struct path_query
+{
+    glm::vec2 m_start;
+    glm::vec2 m_goal;
+};
+
+// waypoints of query i are m_points[m_offsets[i] .. m_offsets[i + 1]),
+// none when goal is unreachable, last one is the exact goal
+struct path_batch
+{
+    glm::vec2 const *m_points;
+    unsigned const *m_offsets;
+    unsigned m_size;
+};
+
+// Every distinct (start cell, goal cell) pair is searched once, on worker
+// threads, and cached until the grid changes.
+// Call blocks until the whole batch is searched (threads are started and
+// joined per call, like step_world), only cached pairs are free. Batches
+// bigger than a frame can afford are split over frames by the caller.
+// Result is valid until next find_paths / find_path call.
+path_batch find_paths(unsigned grid_id, path_query const *queries, unsigned count, path_search search = path_search::jps);
+
+// single query written into path, false when goal is unreachable
+bool find_path(unsigned grid_id, glm::vec2 start, glm::vec2 goal, unsigned path_id, path_search search = path_search::jps);
+
+// Direction towards goal for every cell of a grid, shared by whole armies.
+// Built from integration field (Dijkstra from goal over grid costs),
+// possibly over several frames, previous field is used meanwhile.
+unsigned create_flow_field(unsigned grid_id);
+void set_flow_field_goal(unsigned field_id, glm::vec2 goal);
+// integrates at most max_cells cells, rebuilds when grid changed,
+// returns true when field for current goal is ready
+bool update_flow_field(unsigned field_id, unsigned max_cells = ~0u);
+// unit vector, zero in goal cell and cells which cannot reach goal
+glm::vec2 sample_flow_field(unsigned field_id, glm::vec2 position);
+
+void follow_flow_field(unsigned army_id, unsigned field_id);
+
+// Abstract graph over square clusters of a grid (HPA*) for long range
+// queries. Entrances between clusters and costs between entrances of
+// a cluster are precomputed, clusters with changed cells are rebuilt
+// on next query.
+unsigned create_path_hierarchy(unsigned grid_id, unsigned cluster_size = 16);
+// Only first refined_legs legs between entrances are searched on the grid,
+// rest of the path are straight lines between entrances.
+// false when goal is unreachable
+bool find_hierarchical_path(unsigned hierarchy_id, glm::vec2 start, glm::vec2 goal, unsigned path_id,
+                            unsigned refined_legs = 4);
+// called as unit walks the path, refines legs ahead of it,
+// plans again when grid changed
+void refine_hierarchical_path(unsigned hierarchy_id, unsigned path_id, glm::vec2 position);
+
 #endif
\ No newline at end of file
@@ -1,198 +1,840 @@
 #include <mov.h>
 
+#include "angle.h"
+
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <map>
+#include <thread>
 #include <vector>
 
-#include <glm/gtc/matrix_transform.hpp>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace
 {
-    constexpr unsigned ARMIES_MAX_SIZE = 10;
-
-    constexpr unsigned MEM_SIZE = 4096;
-    alignas(4) char MEMORY[MEM_SIZE];
+    constexpr unsigned ARMIES_MAX_SIZE = 4096;
+    constexpr unsigned COMPONENTS_MAX_SIZE = 32;
+    constexpr size_t CACHE_LINE = 64;
+
+    // Columns hold army size rounded up to this many units, so every column
+    // (elements of 4 bytes and more) ends on a cache line and column i of
+    // neighbouring armies in one allocation follow each other.
+    constexpr unsigned UNIT_PADDING = 16;
+
+    // only pages in use are ever touched,
+    // million unit armies need large arena (cmake -DMOV_LARGE_ARENA=ON)
+#ifdef __MOV_LARGE_ARENA__
+    constexpr size_t MEM_SIZE = size_t(1) << 29;
+#else
+    constexpr size_t MEM_SIZE = 1 << 26;
+#endif
+    alignas(CACHE_LINE) char MEMORY[MEM_SIZE];
     char *MEMORY_PTR{MEMORY};
 
-    void *allocate(size_t bytes)
+    char *align_memory(size_t alignment)
     {
-        if ((MEMORY_PTR + bytes) > &MEMORY[MEM_SIZE - 1])
-            assert(false);
-        void *p = MEMORY_PTR;
-        MEMORY_PTR += bytes;
-        return p;
+        auto const addr = reinterpret_cast<uintptr_t>(MEMORY_PTR);
+        return MEMORY_PTR + ((alignment - addr % alignment) % alignment);
     }
 
-    void *allocate_once(unsigned army_id, size_t bytes)
+    bool fits_in_memory(size_t bytes, size_t alignment)
     {
-        static std::map<unsigned, void *> reg;
-        if (reg[army_id] != nullptr)
-        {
-            return reg[army_id];
-        }
+        char *const p = align_memory(alignment);
+        return p <= MEMORY + MEM_SIZE && bytes <= size_t(MEMORY + MEM_SIZE - p);
+    }
 
-        reg[army_id] = allocate(bytes);
-        return reg[army_id];
+    // running out would overwrite other statics, so it stops any build
+    [[noreturn]] void out_of_memory()
+    {
+        std::fputs("mov: unit arena is full\n", stderr);
+#ifndef __MOV_LARGE_ARENA__
+        std::fputs("mov: build with -DMOV_LARGE_ARENA=ON for bigger armies\n", stderr);
+#endif
+        std::abort();
     }
 
-    struct kinematic_data
+    void *allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
     {
-        glm::vec2 *m_position;
-        glm::vec2 *m_velocity;
-        float *m_orientation;
-        float *m_rotation;
-    };
+        if (!fits_in_memory(bytes, alignment))
+            out_of_memory();
+
+        char *const p = align_memory(alignment);
+        MEMORY_PTR = p + bytes;
+        return p;
+    }
 
-    struct kinematic_steering
+    struct component_info
     {
-        glm::vec2 *m_linear;
-        float *m_angular;
+        size_t m_element_size;
+        size_t m_alignment;
+        // computed from other columns, left out of world hash
+        bool m_derived;
     };
 
+    struct component_registry
+    {
+        unsigned m_size;
+        component_info m_info[COMPONENTS_MAX_SIZE];
+    } COMPONENTS;
+
     struct army
     {
         static unsigned m_army_id;
-        std::array<kinematic_data, ARMIES_MAX_SIZE> m_data;
-        std::array<kinematic_steering, ARMIES_MAX_SIZE> m_steering;
+        // column per registered component, allocated on first use
+        std::array<std::array<void *, COMPONENTS_MAX_SIZE>, ARMIES_MAX_SIZE> m_columns;
     } ARMIES;
 
-    struct army_models
-    {
-        std::array<glm::mat4 *, ARMIES_MAX_SIZE> m_data;
-    } army_models;
-
     unsigned army::m_army_id{0};
 
 #define ARMY_EXIST(army_id) assert(army_id <= army::m_army_id && army_id >= 0)
 
+    enum model_kind
+    {
+        MODEL_P_O,
+        MODEL_P_V,
+        MODEL_P_SL,
+        MODEL_KINDS
+    };
+
+    // dirty bits are kept per 64 units chunk
+    constexpr unsigned CHUNK = 64;
+
     struct army_info
     {
         unsigned m_army_size;
+        // bit per unit, set when its model of given kind is stale
+        std::uint64_t *m_dirty[MODEL_KINDS];
+        float m_rotation_offset[MODEL_KINDS];
+        // models of given kind were last written there, masks track that one only
+        glm::mat4 const *m_destination[MODEL_KINDS];
+        // index of unit 0 in columns of its block
+        unsigned m_block_offset;
     } ARMY_INFO[ARMIES_MAX_SIZE];
 
+    // Armies created by one create_armies call. Column of a component
+    // is one array over all of them, padding units included.
+    struct army_block
+    {
+        unsigned m_first_army;
+        unsigned m_count;
+        unsigned m_units;
+    };
+
+    std::array<army_block, ARMIES_MAX_SIZE> BLOCKS;
+    unsigned BLOCKS_SIZE{0};
+
+    // units per step_world task, multiple of CHUNK so tasks never share dirty words
+    constexpr unsigned STEP_UNITS = 64 * CHUNK;
+
+    // kinematic data
+    component<glm::vec2> const POSITION = register_component<glm::vec2>();
+    component<glm::vec2> const VELOCITY = register_component<glm::vec2>();
+    component<float> const ORIENTATION = register_component<float>();
+    component<float> const ROTATION = register_component<float>();
+
+    // kinematic steering
+    component<glm::vec2> const STEERING_LINEAR = register_component<glm::vec2>();
+    component<float> const STEERING_ANGULAR = register_component<float>();
+
+    template <typename T>
+    component<T> derived(component<T> c)
+    {
+        COMPONENTS.m_info[c.m_id].m_derived = true;
+        return c;
+    }
+
+    component<glm::mat4> const MODEL[MODEL_KINDS] = {derived(register_component<glm::mat4>()),
+                                                     derived(register_component<glm::mat4>()),
+                                                     derived(register_component<glm::mat4>())};
+
+    // state at the time units were last marked dirty,
+    // changes are measured against it so slow drift still accumulates
+    component<glm::vec2> const POSITION_REF = derived(register_component<glm::vec2>());
+    component<float> const ORIENTATION_REF = derived(register_component<float>());
+    component<glm::vec2> const VELOCITY_REF = derived(register_component<glm::vec2>());
+    component<glm::vec2> const STEERING_LINEAR_REF = derived(register_component<glm::vec2>());
+
+    // to retain wander values between runs
+    component<float> const WANDER_ORIENTATION = register_component<float>();
+
+    // Random generator state per unit, results do not depend on order
+    // armies or units are processed in, and snapshots carry it along.
+    component<std::uint64_t> const RANDOM_STATE = register_component<std::uint64_t>();
+    std::uint64_t RANDOM_SEED{0x2545F4914F6CDD1D};
+
     float *get_rotation(unsigned army_id)
     {
         ARMY_EXIST(army_id);
-        return ARMIES.m_data[army_id].m_rotation;
+        return get_component(army_id, ROTATION);
     }
 
     float *get_steering_angular(unsigned army_id)
     {
         ARMY_EXIST(army_id);
-        return ARMIES.m_steering[army_id].m_angular;
+        return get_component(army_id, STEERING_ANGULAR);
+    }
+
+    glm::mat4 *get_models(unsigned army_id, model_kind kind)
+    {
+        ARMY_EXIST(army_id);
+        return get_component(army_id, MODEL[kind]);
+    }
+
+    unsigned chunk_count(unsigned army_size)
+    {
+        return (army_size + CHUNK - 1) / CHUNK;
+    }
+
+    size_t align_up(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    unsigned padded_size(unsigned army_size)
+    {
+        return unsigned(align_up(army_size, UNIT_PADDING));
+    }
+
+    size_t column_alignment(component_info const &info)
+    {
+        return std::max(info.m_alignment, CACHE_LINE);
+    }
+
+    // whole cache lines, so neighbouring columns never share one
+    size_t column_bytes(component_info const &info, unsigned army_size)
+    {
+        return align_up(padded_size(army_size) * info.m_element_size, column_alignment(info));
+    }
+
+    size_t dirty_bytes(unsigned army_size)
+    {
+        return align_up(chunk_count(army_size) * sizeof(std::uint64_t), CACHE_LINE);
+    }
+
+    void mark_all_dirty(unsigned army_id, model_kind kind)
+    {
+        auto const army_size = ARMY_INFO[army_id].m_army_size;
+        auto dirty = ARMY_INFO[army_id].m_dirty[kind];
+
+        for (unsigned c = 0; c < chunk_count(army_size); ++c)
+        {
+            dirty[c] = ~std::uint64_t{0};
+        }
+
+        // no bits past the last unit
+        if (auto const tail = army_size % CHUNK; tail != 0)
+        {
+            dirty[army_size / CHUNK] = (std::uint64_t{1} << tail) - 1;
+        }
     }
 
     // returns angle(rad) between vector and x axis
     float x_vector_angle_rad(float const current, glm::vec2 const vector)
     {
-        if (glm::length(vector) > 0)
+        return glm::dot(vector, vector) > 0.0f ? angle::atan2(vector.y, vector.x) : current;
+    }
+
+    glm::vec2 convert_to_vec2(float const angle_rad)
+    {
+        return angle::to_vec2(angle_rad);
+    }
+
+    // unit vector of v, +x axis for zero vector (same as angle 0)
+    glm::vec2 direction_of(glm::vec2 const v)
+    {
+        float const len2 = glm::dot(v, v);
+        return len2 > 0.0f ? v / std::sqrt(len2) : glm::vec2{1.0f, 0.0f};
+    }
+
+    // rotates unit direction d by angle given as {cos, sin}
+    glm::vec2 rotate_by(glm::vec2 const d, glm::vec2 const r)
+    {
+        return {d.x * r.x - d.y * r.y, d.x * r.y + d.y * r.x};
+    }
+
+    // translate(p) * rotate(angle, z) written directly, dir = {cos, sin}
+    // translate(p) * rotate by dir, four column stores per unit
+    void store_model(glm::mat4 *out, glm::vec2 const p, glm::vec2 const dir, bool streaming)
+    {
+#if defined(__SSE2__)
+        if (streaming)
         {
-            return atan2(vector.y, vector.x);
+            float *const m = &(*out)[0][0];
+            _mm_stream_ps(m + 0, _mm_setr_ps(dir.x, dir.y, 0.0f, 0.0f));
+            _mm_stream_ps(m + 4, _mm_setr_ps(-dir.y, dir.x, 0.0f, 0.0f));
+            _mm_stream_ps(m + 8, _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f));
+            _mm_stream_ps(m + 12, _mm_setr_ps(p.x, p.y, 0.0f, 1.0f));
+            return;
         }
-        return current;
+#endif
+        (*out)[0] = {dir.x, dir.y, 0.0f, 0.0f};
+        (*out)[1] = {-dir.y, dir.x, 0.0f, 0.0f};
+        (*out)[2] = {0.0f, 0.0f, 1.0f, 0.0f};
+        (*out)[3] = {p.x, p.y, 0.0f, 1.0f};
     }
 
-    glm::vec2 convert_to_vec2(float const angle_rad)
+    // Models are written once and only read by the renderer
+    // (or land in a mapped GPU buffer), so they bypass the cache.
+    // Only units with dirty bit set are written, bits are cleared.
+    // direction(i) returns {cos, sin} of unit i rotation.
+    // Not a SIMD kernel: dirty units are scattered, so directions and
+    // matrices are scalar code per unit, only the stores are SSE
+    // (non-temporal). Batch of 8 just separates index gathering,
+    // direction math and stores into tight loops.
+    template <typename F>
+    model_range write_models(glm::vec2 const *p, glm::mat4 *out, unsigned count,
+                             std::uint64_t *dirty, F direction)
+    {
+        constexpr unsigned BATCH = 8;
+        bool const streaming = reinterpret_cast<uintptr_t>(out) % 16 == 0;
+
+        unsigned first = count;
+        unsigned last = 0;
+
+        unsigned index[BATCH];
+        glm::vec2 dir[BATCH];
+        for (unsigned c = 0; c < chunk_count(count); ++c)
+        {
+            std::uint64_t mask = dirty[c];
+            dirty[c] = 0;
+
+            // idle chunk
+            if (mask == 0)
+                continue;
+
+            first = std::min(first, c * CHUNK + std::countr_zero(mask));
+            last = std::max(last, c * CHUNK + (CHUNK - std::countl_zero(mask)));
+
+            while (mask)
+            {
+                unsigned n = 0;
+                for (; n < BATCH && mask; ++n)
+                {
+                    index[n] = c * CHUNK + std::countr_zero(mask);
+                    mask &= mask - 1;
+                }
+
+                for (unsigned i = 0; i < n; ++i)
+                    dir[i] = direction(index[i]);
+
+                for (unsigned i = 0; i < n; ++i)
+                    store_model(out + index[i], p[index[i]], dir[i], streaming);
+            }
+        }
+
+#if defined(__SSE2__)
+        _mm_sfence();
+#endif
+        return first < last ? model_range{first, last - first} : model_range{0, 0};
+    }
+
+    // whole army is stale when models are requested with another offset
+    void check_rotation_offset(unsigned army_id, model_kind kind, float rotation_offset)
+    {
+        auto &offset = ARMY_INFO[army_id].m_rotation_offset[kind];
+        if (offset != rotation_offset)
+        {
+            offset = rotation_offset;
+            mark_all_dirty(army_id, kind);
+        }
+    }
+
+    // and when they are written somewhere else, which never saw the old ones
+    void check_destination(unsigned army_id, model_kind kind, glm::mat4 const *out)
+    {
+        auto &destination = ARMY_INFO[army_id].m_destination[kind];
+        if (destination != out)
+        {
+            destination = out;
+            mark_all_dirty(army_id, kind);
+        }
+    }
+
+    // Marks models of units which moved, turned, or changed
+    // velocity / steering by more than epsilon since last marked.
+    // Columns integration works on. Taken from an army, or from first army
+    // of a block, then unit indices run over the whole block.
+    struct unit_columns
+    {
+        glm::vec2 *m_p;
+        glm::vec2 *m_v;
+        float *m_o;
+        float *m_r;
+        glm::vec2 const *m_sl;
+        float const *m_sa;
+
+        glm::vec2 *m_p_ref;
+        float *m_o_ref;
+        glm::vec2 *m_v_ref;
+        glm::vec2 *m_sl_ref;
+    };
+
+    unit_columns columns_of(unsigned army_id)
     {
-        return {glm::cos(angle_rad), glm::sin(angle_rad)};
+        return {get_position(army_id), get_velocity(army_id), get_orientation(army_id), get_rotation(army_id),
+                get_steering_linear(army_id), get_steering_angular(army_id),
+                get_component(army_id, POSITION_REF), get_component(army_id, ORIENTATION_REF),
+                get_component(army_id, VELOCITY_REF), get_component(army_id, STEERING_LINEAR_REF)};
     }
 
-    constexpr float PI = 3.1415f;
+    void integrate(unit_columns const &c, unsigned first, unsigned last, float dt)
+    {
+        constexpr float max_velocity = 3.0f;
+
+        for (unsigned i = first; i < last; ++i)
+        {
+            c.m_p[i] += c.m_v[i] * dt;
+            c.m_o[i] += c.m_r[i] * dt;
+
+            c.m_v[i] += c.m_sl[i] * dt;
+            c.m_r[i] += c.m_sa[i] * dt;
+
+            // this works for dynamic only
+            // because kinematic version updated position
+            // at this point
+            if (glm::length(c.m_v[i]) > max_velocity)
+            {
+                c.m_v[i] = glm::normalize(c.m_v[i]) * max_velocity;
+            }
+        }
+    }
 
-    // maps rotation to -pi, pi interval.
-    float map_to_range(float rotation)
+    // sets dirty bits of army units [first, last), unit 0 of the army
+    // is at index base of the columns
+    void track_dirty(unit_columns const &c, unsigned base, unsigned first, unsigned last,
+                     std::uint64_t *const *dirty)
     {
-        while (rotation > PI)
-            rotation -= 2 * PI;
+        constexpr float position_eps = 1e-4f;
+        constexpr float orientation_eps = 1e-4f;
+        constexpr float vector_eps = 1e-4f;
 
-        while (rotation < -PI)
-            rotation += 2 * PI;
+        for (unsigned u = first; u < last; ++u)
+        {
+            unsigned const i = base + u;
+            bool const moved = glm::length(c.m_p[i] - c.m_p_ref[i]) > position_eps ||
+                               glm::abs(c.m_o[i] - c.m_o_ref[i]) > orientation_eps;
+            bool const v_changed = moved || glm::length(c.m_v[i] - c.m_v_ref[i]) > vector_eps;
+            bool const sl_changed = moved || glm::length(c.m_sl[i] - c.m_sl_ref[i]) > vector_eps;
+
+            c.m_p_ref[i] = moved ? c.m_p[i] : c.m_p_ref[i];
+            c.m_o_ref[i] = moved ? c.m_o[i] : c.m_o_ref[i];
+            c.m_v_ref[i] = v_changed ? c.m_v[i] : c.m_v_ref[i];
+            c.m_sl_ref[i] = sl_changed ? c.m_sl[i] : c.m_sl_ref[i];
+
+            std::uint64_t const bit = std::uint64_t{1} << (u % CHUNK);
+            dirty[MODEL_P_O][u / CHUNK] |= moved ? bit : 0;
+            dirty[MODEL_P_V][u / CHUNK] |= v_changed ? bit : 0;
+            dirty[MODEL_P_SL][u / CHUNK] |= sl_changed ? bit : 0;
+        }
+    }
+
+    // block units [m_first, m_last), m_army is the first army they touch
+    struct step_task
+    {
+        unsigned m_block;
+        unsigned m_army;
+        unsigned m_first;
+        unsigned m_last;
+    };
 
-        return rotation;
+    // Small armies are merged into one task, big ones split at STEP_UNITS
+    // multiples of their own units.
+    void split_blocks(std::vector<step_task> &tasks)
+    {
+        tasks.clear();
+        for (unsigned b = 0; b < BLOCKS_SIZE; ++b)
+        {
+            auto const &block = BLOCKS[b];
+            step_task task{b, block.m_first_army, 0, 0};
+
+            for (unsigned a = block.m_first_army; a < block.m_first_army + block.m_count; ++a)
+            {
+                unsigned const offset = ARMY_INFO[a].m_block_offset;
+                unsigned const units = padded_size(ARMY_INFO[a].m_army_size);
+                for (unsigned piece = 0; piece < units; piece += STEP_UNITS)
+                {
+                    if (task.m_last - task.m_first >= STEP_UNITS)
+                    {
+                        tasks.push_back(task);
+                        task = {b, a, offset + piece, offset + piece};
+                    }
+                    task.m_last = offset + std::min(piece + STEP_UNITS, units);
+                }
+            }
+
+            if (task.m_last > task.m_first)
+                tasks.push_back(task);
+        }
+    }
+
+    void run_step(step_task const &task, float dt)
+    {
+        auto const &block = BLOCKS[task.m_block];
+        auto const c = columns_of(block.m_first_army);
+
+        integrate(c, task.m_first, task.m_last, dt);
+
+        for (unsigned a = task.m_army; a < block.m_first_army + block.m_count; ++a)
+        {
+            auto const &info = ARMY_INFO[a];
+            if (info.m_block_offset >= task.m_last)
+                break;
+
+            unsigned const first = std::max(task.m_first, info.m_block_offset) - info.m_block_offset;
+            unsigned const last = std::min(task.m_last - info.m_block_offset, info.m_army_size);
+            if (first < last)
+                track_dirty(c, info.m_block_offset, first, last, info.m_dirty);
+        }
+    }
+
+    glm::vec2 arrive_steering(glm::vec2 const p, glm::vec2 const v, glm::vec2 const target_pos)
+    {
+        constexpr float slow_radius{2.0f};
+        constexpr float max_acceleration{3.0f};
+        constexpr float max_speed{3.0f};
+        constexpr float acceleration_boost{10.0f};
+
+        auto const dir = target_pos - p;
+        float const distance = glm::length(dir);
+
+        // closer to target, lower speed
+        float target_speed{};
+        if (distance > slow_radius)
+        {
+            target_speed = max_speed;
+        }
+        else
+        {
+            target_speed = max_speed * distance / slow_radius;
+        }
+        // already there, nothing to normalize
+        auto const goal_velocity = distance > 0.0f ? dir * (target_speed / distance) : glm::vec2{0.0f};
+
+        // sl will be opposite do v
+        // when we are close to the target
+        // but this value will be too small
+        // to lose that speed and we will start wiggling
+        // so...
+        glm::vec2 sl = goal_velocity - v;
+
+        // ...we need to increase acceleration
+        sl *= acceleration_boost;
+
+        if (glm::length(sl) > max_acceleration)
+        {
+            sl = glm::normalize(sl) * max_acceleration;
+        }
+        return sl;
+    }
+
+    // splitmix64 step
+    std::uint64_t next_random(std::uint64_t &state)
+    {
+        std::uint64_t z = (state += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        return z ^ (z >> 31);
     }
 
     // can return -1, 0 or 1
-    int random_binominal()
+    int random_binominal(std::uint64_t &state)
+    {
+        auto const r = next_random(state);
+        return int(r & 1) - int((r >> 1) & 1);
+    }
+
+    void seed_random(unsigned army_id)
+    {
+        auto state = get_component(army_id, RANDOM_STATE);
+        std::uint64_t army_state = RANDOM_SEED ^ (std::uint64_t{army_id} << 32);
+        for (unsigned i = 0; i < ARMY_INFO[army_id].m_army_size; ++i)
+        {
+            state[i] = next_random(army_state);
+        }
+    }
+
+    constexpr std::uint64_t HASH_PRIME_1 = 0x9E3779B185EBCA87;
+    constexpr std::uint64_t HASH_PRIME_2 = 0xC2B2AE3D27D4EB4F;
+
+    std::uint64_t hash_round(std::uint64_t acc, std::uint64_t word)
+    {
+        return std::rotl(acc + word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+    }
+
+    // xxHash64 like, four independent lanes so it runs at memory speed,
+    // no data hashes as that many zero bytes
+    std::uint64_t hash_bytes(std::uint64_t h, void const *data, size_t bytes)
     {
-        return (rand() % 2) - (rand() % 2);
+        auto const *p = static_cast<unsigned char const *>(data);
+        std::uint64_t lane[4] = {h + HASH_PRIME_1, h + HASH_PRIME_2, h, h - HASH_PRIME_1};
+
+        size_t i = 0;
+        for (; i + 32 <= bytes; i += 32)
+        {
+            std::uint64_t words[4]{};
+            if (p != nullptr)
+                std::memcpy(words, p + i, sizeof(words));
+            for (unsigned k = 0; k < 4; ++k)
+            {
+                lane[k] = hash_round(lane[k], words[k]);
+            }
+        }
+
+        h = std::rotl(lane[0], 1) + std::rotl(lane[1], 7) + std::rotl(lane[2], 12) + std::rotl(lane[3], 18);
+        for (; i < bytes; i += 8)
+        {
+            std::uint64_t word{};
+            if (p != nullptr)
+                std::memcpy(&word, p + i, std::min<size_t>(8, bytes - i));
+            h = hash_round(h ^ bytes, word);
+        }
+
+        h ^= h >> 33;
+        h *= HASH_PRIME_2;
+        h ^= h >> 29;
+        return h;
+    }
+
+    // column index below MODEL_KINDS is a dirty mask, component column above
+    void *get_column(unsigned army_id, unsigned column)
+    {
+        return column < MODEL_KINDS ? static_cast<void *>(ARMY_INFO[army_id].m_dirty[column])
+                                    : ARMIES.m_columns[army_id][column - MODEL_KINDS];
     }
+
+    void set_column(unsigned army_id, unsigned column, char *data)
+    {
+        if (column < MODEL_KINDS)
+            ARMY_INFO[army_id].m_dirty[column] = reinterpret_cast<std::uint64_t *>(data);
+        else
+            ARMIES.m_columns[army_id][column - MODEL_KINDS] = data;
+    }
+
+    size_t block_alignment()
+    {
+        size_t alignment{CACHE_LINE};
+        for (unsigned c = 0; c < COMPONENTS.m_size; ++c)
+        {
+            alignment = std::max(alignment, column_alignment(COMPONENTS.m_info[c]));
+        }
+        return alignment;
+    }
+
+    // Block of armies: dirty masks, then column of component c for all
+    // armies, then component c + 1, so sweeps over one component of many
+    // armies stay in one piece of memory. Calls f(offset, bytes, army, column)
+    // in that order, returns size of the block.
+    template <typename F>
+    size_t lay_out(unsigned first_army_id, std::span<unsigned const> sizes, F f)
+    {
+        size_t offset{};
+        for (unsigned k = 0; k < MODEL_KINDS; ++k)
+        {
+            for (unsigned a = 0; a < sizes.size(); ++a)
+            {
+                f(offset, dirty_bytes(sizes[a]), first_army_id + a, k);
+                offset += dirty_bytes(sizes[a]);
+            }
+        }
+        for (unsigned c = 0; c < COMPONENTS.m_size; ++c)
+        {
+            auto const &info = COMPONENTS.m_info[c];
+            for (unsigned a = 0; a < sizes.size(); ++a)
+            {
+                offset = align_up(offset, column_alignment(info));
+                f(offset, column_bytes(info, sizes[a]), first_army_id + a, MODEL_KINDS + c);
+                offset += column_bytes(info, sizes[a]);
+            }
+        }
+        return offset;
+    }
+
+    void add_block(unsigned first_army_id, std::span<unsigned const> sizes)
+    {
+        unsigned units{};
+        for (unsigned a = 0; a < sizes.size(); ++a)
+        {
+            ARMY_INFO[first_army_id + a].m_army_size = sizes[a];
+            ARMY_INFO[first_army_id + a].m_block_offset = units;
+            units += padded_size(sizes[a]);
+        }
+        BLOCKS[BLOCKS_SIZE++] = {first_army_id, unsigned(sizes.size()), units};
+        army::m_army_id = first_army_id + unsigned(sizes.size());
+    }
+
+    // snapshot file, tables are followed by the block of all armies
+    constexpr char SNAPSHOT_MAGIC[8] = {'M', 'O', 'V', 'S', 'N', 'A', 'P', '\0'};
+    constexpr std::uint32_t SNAPSHOT_VERSION = 1;
+
+    struct snapshot_header
+    {
+        char m_magic[8];
+        std::uint32_t m_version;
+        std::uint32_t m_armies;
+        std::uint32_t m_components;
+        std::uint32_t m_reserved;
+        // offset of the block, whole file size
+        std::uint64_t m_data;
+        std::uint64_t m_bytes;
+    };
+
+    struct snapshot_component
+    {
+        std::uint64_t m_element_size;
+        std::uint64_t m_alignment;
+    };
+
+    struct snapshot_army
+    {
+        std::uint32_t m_size;
+        float m_rotation_offset[MODEL_KINDS];
+    };
+
+    // file mapping armies currently live in, if loaded
+    void *SNAPSHOT{};
+    size_t SNAPSHOT_SIZE{};
 } // Anonymous NS
 
 unsigned create_army(unsigned size)
 {
-    auto new_army_id = army::m_army_id;
+    return create_armies({&size, 1});
+}
 
-    ARMIES.m_data[new_army_id].m_position = (glm::vec2 *)allocate(size * sizeof(glm::vec2));
-    ARMIES.m_data[new_army_id].m_velocity = (glm::vec2 *)allocate(size * sizeof(glm::vec2));
-    ARMIES.m_data[new_army_id].m_orientation = (float *)allocate(size * sizeof(float));
-    ARMIES.m_data[new_army_id].m_rotation = (float *)allocate(size * sizeof(float));
+unsigned create_armies(std::span<unsigned const> sizes)
+{
+    auto const first_army_id = army::m_army_id;
+    assert(first_army_id + sizes.size() <= ARMIES_MAX_SIZE);
+
+    // columns of components registered later are allocated in get_component
+    auto const bytes = lay_out(first_army_id, sizes, [](size_t, size_t, unsigned, unsigned) {});
+    if (!fits_in_memory(bytes, block_alignment()))
+        out_of_memory();
+    char *const block = static_cast<char *>(allocate(bytes, block_alignment()));
+    lay_out(first_army_id, sizes, [block](size_t offset, size_t, unsigned army_id, unsigned column)
+            { set_column(army_id, column, block + offset); });
+
+    add_block(first_army_id, sizes);
+    for (unsigned a = 0; a < sizes.size(); ++a)
+    {
+        seed_random(first_army_id + a);
+        mark_dirty(first_army_id + a);
+    }
 
-    ARMIES.m_steering[new_army_id].m_linear = (glm::vec2 *)allocate(size * sizeof(glm::vec2));
-    ARMIES.m_steering[new_army_id].m_angular = (float *)allocate(size * sizeof(float));
+    return first_army_id;
+}
 
-    ARMY_INFO[new_army_id].m_army_size = size;
+void mark_dirty(unsigned army_id)
+{
+    ARMY_EXIST(army_id);
 
-    army_models.m_data[new_army_id] = (glm::mat4 *)allocate(size * sizeof(glm::mat4));
+    for (unsigned k = 0; k < MODEL_KINDS; ++k)
+    {
+        mark_all_dirty(army_id, model_kind(k));
+    }
 
-    army::m_army_id++;
-    return new_army_id;
+    // current state is what the models will be built from
+    auto const army_size = ARMY_INFO[army_id].m_army_size;
+    std::copy_n(get_position(army_id), army_size, get_component(army_id, POSITION_REF));
+    std::copy_n(get_orientation(army_id), army_size, get_component(army_id, ORIENTATION_REF));
+    std::copy_n(get_velocity(army_id), army_size, get_component(army_id, VELOCITY_REF));
+    std::copy_n(get_steering_linear(army_id), army_size, get_component(army_id, STEERING_LINEAR_REF));
 }
 
-void set_formation(unsigned army_id, formation f, glm::vec2 spawn, float spacing)
+unsigned get_army_size(unsigned army_id)
 {
     ARMY_EXIST(army_id);
+    return ARMY_INFO[army_id].m_army_size;
+}
 
-    auto const army_size = ARMY_INFO[army_id].m_army_size;
-    auto &kin_data = ARMIES.m_data[army_id];
+unsigned get_army_count()
+{
+    return army::m_army_id;
+}
+
+unsigned register_component(size_t element_size, size_t alignment)
+{
+    assert(COMPONENTS.m_size < COMPONENTS_MAX_SIZE);
+
+    auto const new_component_id = COMPONENTS.m_size;
+    COMPONENTS.m_info[new_component_id] = {element_size, alignment, false};
 
-    switch (f)
+    COMPONENTS.m_size++;
+    return new_component_id;
+}
+
+void *get_component(unsigned army_id, unsigned component_id)
+{
+    ARMY_EXIST(army_id);
+    assert(component_id < COMPONENTS.m_size);
+
+    void *&column = ARMIES.m_columns[army_id][component_id];
+    if (column == nullptr)
     {
-    case formation::line_along_x_towards_y:
-        glm::vec2 s = spawn;
-        for (unsigned i = 0; i < army_size; ++i)
-        {
-            kin_data.m_position[i] = s;
-            s.x += spacing;
-        }
-        break;
+        auto const &info = COMPONENTS.m_info[component_id];
+        column = allocate(column_bytes(info, ARMY_INFO[army_id].m_army_size), column_alignment(info));
     }
+    return column;
 }
 
 void update_army(unsigned army_id, float dt)
 {
     ARMY_EXIST(army_id);
 
-    auto v = get_velocity(army_id);
-    auto p = get_position(army_id);
-    auto o = get_orientation(army_id);
-    auto r = get_rotation(army_id);
-    auto const sl = get_steering_linear(army_id);
-    auto const sa = get_steering_angular(army_id);
+    auto const c = columns_of(army_id);
+    auto const &info = ARMY_INFO[army_id];
 
-    auto const army_size = ARMY_INFO[army_id].m_army_size;
-
-    constexpr float max_velocity = 3.0f;
+    integrate(c, 0, info.m_army_size, dt);
+    track_dirty(c, 0, 0, info.m_army_size, info.m_dirty);
+}
 
-    for (unsigned i = 0; i < army_size; ++i)
-    {
-        p[i] += v[i] * dt;
-        o[i] += r[i] * dt;
+void step_world(float dt, unsigned workers)
+{
+    static std::vector<step_task> tasks;
+    split_blocks(tasks);
 
-        v[i] += sl[i] * dt;
-        r[i] += sa[i] * dt;
+    unsigned const hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    workers = std::clamp(workers == 0 ? hardware : workers, 1u, std::max(unsigned(tasks.size()), 1u));
 
-        // this works for dynamic only
-        // because kinematic version updated position
-        // at this point
-        if (glm::length(v[i]) > max_velocity)
+    std::atomic<unsigned> next{0};
+    auto const work = [&]()
+    {
+        for (unsigned i = next++; i < tasks.size(); i = next++)
         {
-            v[i] = glm::normalize(v[i]) * max_velocity;
+            run_step(tasks[i], dt);
         }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned w = 1; w < workers; ++w)
+    {
+        threads.emplace_back(work);
     }
+    work();
+
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    record_replay_tick();
 }
 
-glm::mat4 *calculate_models_p_o(unsigned army_id, float rotation_offset)
+model_range write_models_p_o(unsigned army_id, glm::mat4 *out, float rotation_offset)
 {
     ARMY_EXIST(army_id);
 
@@ -200,84 +842,94 @@ glm::mat4 *calculate_models_p_o(unsigned army_id, float rotation_offset)
     auto const p = get_position(army_id);
     auto const o = get_orientation(army_id);
 
-    for (unsigned i = 0; i < army_size; ++i)
-    {
-        glm::mat4 model{1.0f};
-        model = glm::translate(model, glm::vec3{p[i], 0.0f});
+    check_rotation_offset(army_id, MODEL_P_O, rotation_offset);
+    check_destination(army_id, MODEL_P_O, out);
 
-        // -90* is because model is pointing at +y axis
-        // and 0* orientation should be pointing at +x axis
-        model = glm::rotate(model, o[i] - glm::radians(rotation_offset), glm::vec3{0.0f, 0.0f, 1.0f});
-        army_models.m_data[army_id][i] = model;
-    }
+    // -90* is because model is pointing at +y axis
+    // and 0* orientation should be pointing at +x axis
+    float const offset = glm::radians(rotation_offset);
 
-    return army_models.m_data[army_id];
+    return write_models(p, out, army_size, ARMY_INFO[army_id].m_dirty[MODEL_P_O], [o, offset](unsigned i)
+                        { return convert_to_vec2(o[i] - offset); });
 }
 
-// translate by position
-// rotate    by velocity
-glm::mat4 *calculate_models_p_v(unsigned army_id, float rotation_offset)
+glm::mat4 *calculate_models_p_o(unsigned army_id, float rotation_offset)
+{
+    auto models = get_models(army_id, MODEL_P_O);
+    write_models_p_o(army_id, models, rotation_offset);
+    return models;
+}
+
+model_range write_models_p_v(unsigned army_id, glm::mat4 *out, float rotation_offset)
 {
     ARMY_EXIST(army_id);
 
     auto const army_size = ARMY_INFO[army_id].m_army_size;
     auto const p = get_position(army_id);
     auto const v = get_velocity(army_id);
+    auto const offset = convert_to_vec2(-glm::radians(rotation_offset));
 
-    for (unsigned i = 0; i < army_size; ++i)
-    {
-        glm::mat4 model{1.0f};
-        model = glm::translate(model, glm::vec3{p[i], 0.0f});
-        // and 0* orientation should be pointing at +x axis
-        model = glm::rotate(model, x_vector_angle_rad(0.0f, v[i]) - glm::radians(rotation_offset), glm::vec3{0.0f, 0.0f, 1.0f});
-        army_models.m_data[army_id][i] = model;
-    }
+    check_rotation_offset(army_id, MODEL_P_V, rotation_offset);
+    check_destination(army_id, MODEL_P_V, out);
 
-    return army_models.m_data[army_id];
+    return write_models(p, out, army_size, ARMY_INFO[army_id].m_dirty[MODEL_P_V], [v, offset](unsigned i)
+                        { return rotate_by(direction_of(v[i]), offset); });
 }
 
-glm::mat4 *calculate_models_p_sl(unsigned army_id, float rotation_offset)
+// translate by position
+// rotate    by velocity
+glm::mat4 *calculate_models_p_v(unsigned army_id, float rotation_offset)
+{
+    auto models = get_models(army_id, MODEL_P_V);
+    write_models_p_v(army_id, models, rotation_offset);
+    return models;
+}
+
+model_range write_models_p_sl(unsigned army_id, glm::mat4 *out, float rotation_offset)
 {
     ARMY_EXIST(army_id);
 
     auto const army_size = ARMY_INFO[army_id].m_army_size;
     auto const p = get_position(army_id);
     auto const sl = get_steering_linear(army_id);
+    auto const offset = convert_to_vec2(-glm::radians(rotation_offset));
 
-    for (unsigned i = 0; i < army_size; ++i)
-    {
-        glm::mat4 model{1.0f};
-        model = glm::translate(model, glm::vec3{p[i], 0.0f});
-        // and 0* orientation should be pointing at +x axis
-        model = glm::rotate(model, x_vector_angle_rad(0.0f, sl[i]) - glm::radians(rotation_offset), glm::vec3{0.0f, 0.0f, 1.0f});
-        army_models.m_data[army_id][i] = model;
-    }
+    check_rotation_offset(army_id, MODEL_P_SL, rotation_offset);
+    check_destination(army_id, MODEL_P_SL, out);
 
-    return army_models.m_data[army_id];
+    return write_models(p, out, army_size, ARMY_INFO[army_id].m_dirty[MODEL_P_SL], [sl, offset](unsigned i)
+                        { return rotate_by(direction_of(sl[i]), offset); });
+}
+
+glm::mat4 *calculate_models_p_sl(unsigned army_id, float rotation_offset)
+{
+    auto models = get_models(army_id, MODEL_P_SL);
+    write_models_p_sl(army_id, models, rotation_offset);
+    return models;
 }
 
 glm::vec2 *get_position(unsigned army_id)
 {
     ARMY_EXIST(army_id);
-    return ARMIES.m_data[army_id].m_position;
+    return get_component(army_id, POSITION);
 }
 
 float *get_orientation(unsigned army_id)
 {
     ARMY_EXIST(army_id);
-    return ARMIES.m_data[army_id].m_orientation;
+    return get_component(army_id, ORIENTATION);
 }
 
 glm::vec2 *get_steering_linear(unsigned army_id)
 {
     ARMY_EXIST(army_id);
-    return ARMIES.m_steering[army_id].m_linear;
+    return get_component(army_id, STEERING_LINEAR);
 }
 
 glm::vec2 *get_velocity(unsigned army_id)
 {
     ARMY_EXIST(army_id);
-    return ARMIES.m_data[army_id].m_velocity;
+    return get_component(army_id, VELOCITY);
 }
 
 void kinematic_seek(unsigned army_id, glm::vec2 target_pos)
@@ -351,15 +1003,16 @@ void kinematic_wander(unsigned army_id)
 
     auto v = get_velocity(army_id);
     auto r = get_rotation(army_id);
+    auto random = get_component(army_id, RANDOM_STATE);
 
     auto const o = get_orientation(army_id);
     auto const army_size = ARMY_INFO[army_id].m_army_size;
 
+    angle::to_vec2(o, v, army_size);
+
     for (unsigned i = 0; i < army_size; ++i)
     {
-        v[i] = convert_to_vec2(o[i]);
-
-        r[i] = random_binominal();
+        r[i] = random_binominal(random[i]);
     }
 }
 
@@ -402,11 +1055,6 @@ void dynamic_arrive(unsigned army_id, glm::vec2 target_pos)
 {
     ARMY_EXIST(army_id);
 
-    constexpr float slow_radius{2.0f};
-    constexpr float max_acceleration{3.0f};
-    constexpr float max_speed{3.0f};
-    constexpr float acceleration_boost{10.0f};
-
     auto sl = get_steering_linear(army_id);
 
     auto const v = get_velocity(army_id);
@@ -415,35 +1063,23 @@ void dynamic_arrive(unsigned army_id, glm::vec2 target_pos)
 
     for (unsigned i = 0; i < army_size; ++i)
     {
-        auto const dir = target_pos - p[i];
-        float const distance = glm::length(dir);
+        sl[i] = arrive_steering(p[i], v[i], target_pos);
+    }
+}
 
-        // closer to target, lower speed
-        float target_speed{};
-        if (distance > slow_radius)
-        {
-            target_speed = max_speed;
-        }
-        else
-        {
-            target_speed = max_speed * distance / slow_radius;
-        }
-        auto const goal_velocity = glm::normalize(dir) * target_speed;
+void dynamic_arrive(unsigned army_id, glm::vec2 const *target_pos)
+{
+    ARMY_EXIST(army_id);
 
-        // sl will be opposite do v
-        // when we are close to the target
-        // but this value will be too small
-        // to lose that speed and we will start wiggling
-        // so...
-        sl[i] = goal_velocity - v[i];
+    auto sl = get_steering_linear(army_id);
 
-        // ...we need to increase acceleration
-        sl[i] *= acceleration_boost;
+    auto const v = get_velocity(army_id);
+    auto const p = get_position(army_id);
+    auto const army_size = ARMY_INFO[army_id].m_army_size;
 
-        if (glm::length(sl[i]) > max_acceleration)
-        {
-            sl[i] = glm::normalize(sl[i]) * max_acceleration;
-        }
+    for (unsigned i = 0; i < army_size; ++i)
+    {
+        sl[i] = arrive_steering(p[i], v[i], target_pos[i]);
     }
 }
 
@@ -490,32 +1126,23 @@ void align(unsigned army_id, glm::vec2 target_orientation)
     float *const o = get_orientation(army_id);
     float *const r = get_rotation(army_id);
     auto const army_size = ARMY_INFO[army_id].m_army_size;
+
+    float const target_angle = x_vector_angle_rad(0.0f, target_orientation);
+
     for (unsigned i = 0; i < army_size; ++i)
     {
-        float goal_rotation = x_vector_angle_rad(0.0f, target_orientation) - o[i];
-
         //  -PI ... +PI
-        goal_rotation = map_to_range(goal_rotation);
+        float const goal_rotation = angle::wrap(target_angle - o[i]);
         float const rotation_size = glm::abs(goal_rotation);
 
-        float target_rotation{};
-        if (rotation_size > slow_radius)
-            target_rotation = max_rotation;
-        else
-        {
-            target_rotation = max_rotation * rotation_size / slow_radius;
-        }
-
+        // closer to target orientation, slower rotation
+        float target_rotation = max_rotation * glm::min(rotation_size / slow_radius, 1.0f);
         target_rotation *= glm::sign(goal_rotation);
 
         steering_angular[i] = target_rotation - r[i];
         steering_angular[i] *= rotation_boost; // same reason as for dynamic arrive
 
-        auto const steering_value = glm::abs(steering_angular[i]);
-        if (steering_value > max_angular_steering)
-        {
-            steering_angular[i] = glm::sign(steering_angular[i]) * max_angular_steering;
-        }
+        steering_angular[i] = glm::clamp(steering_angular[i], -max_angular_steering, max_angular_steering);
     }
 }
 
@@ -583,13 +1210,12 @@ void wander(unsigned army_id)
     auto const p = get_position(army_id);
     auto const army_size = ARMY_INFO[army_id].m_army_size;
 
-    // to retain this values between runs
-    float *wander_orientation =
-        reinterpret_cast<float *>(allocate_once(army_id, army_size * sizeof(float)));
+    float *wander_orientation = get_component(army_id, WANDER_ORIENTATION);
+    auto random = get_component(army_id, RANDOM_STATE);
 
     for (unsigned i = 0; i < army_size; ++i)
     {
-        wander_orientation[i] += random_binominal() * wander_rate;
+        wander_orientation[i] += random_binominal(random[i]) * wander_rate;
 
         float const target_orientation = wander_orientation[i] + o[i];
 
@@ -603,4 +1229,195 @@ void wander(unsigned army_id)
 
         face(army_id, target);
     }
-}
\ No newline at end of file
+}
+
+bool save_snapshot(char const *file_name)
+{
+    std::FILE *const file = std::fopen(file_name, "wb");
+    if (file == nullptr)
+        return false;
+
+    unsigned const armies = army::m_army_id;
+    std::vector<unsigned> sizes(armies);
+    std::vector<snapshot_army> army_table(armies);
+    for (unsigned a = 0; a < armies; ++a)
+    {
+        sizes[a] = ARMY_INFO[a].m_army_size;
+        army_table[a].m_size = sizes[a];
+        std::copy_n(ARMY_INFO[a].m_rotation_offset, MODEL_KINDS, army_table[a].m_rotation_offset);
+    }
+
+    std::vector<snapshot_component> component_table(COMPONENTS.m_size);
+    for (unsigned c = 0; c < COMPONENTS.m_size; ++c)
+    {
+        component_table[c] = {COMPONENTS.m_info[c].m_element_size, COMPONENTS.m_info[c].m_alignment};
+    }
+
+    size_t const tables = sizeof(snapshot_header) + component_table.size() * sizeof(snapshot_component) +
+                          army_table.size() * sizeof(snapshot_army);
+    size_t const data = align_up(tables, block_alignment());
+
+    snapshot_header header{};
+    std::copy_n(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC), header.m_magic);
+    header.m_version = SNAPSHOT_VERSION;
+    header.m_armies = armies;
+    header.m_components = COMPONENTS.m_size;
+    header.m_data = data;
+    header.m_bytes = data + lay_out(0, sizes, [](size_t, size_t, unsigned, unsigned) {});
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+              std::fwrite(component_table.data(), sizeof(snapshot_component), component_table.size(), file) ==
+                  component_table.size() &&
+              std::fwrite(army_table.data(), sizeof(snapshot_army), army_table.size(), file) == army_table.size();
+    size_t position = tables;
+
+    auto const write_zeros = [&](size_t bytes)
+    {
+        static char const zeros[4096]{};
+        for (size_t n = 0; n < bytes && ok; n += sizeof(zeros))
+        {
+            size_t const count = std::min(bytes - n, sizeof(zeros));
+            ok = std::fwrite(zeros, 1, count, file) == count;
+        }
+        position += bytes;
+    };
+
+    // columns of armies created together are neighbours in memory as well
+    // as in the file, runs of them go out as one write
+    char const *run{};
+    size_t run_bytes{};
+    auto const flush = [&]()
+    {
+        ok = ok && std::fwrite(run, 1, run_bytes, file) == run_bytes;
+        position += run_bytes;
+        run = nullptr;
+        run_bytes = 0;
+    };
+
+    lay_out(0, sizes, [&](size_t offset, size_t bytes, unsigned army_id, unsigned column)
+            {
+                auto const source = static_cast<char const *>(get_column(army_id, column));
+                if (run != nullptr && run + run_bytes == source && position + run_bytes == data + offset)
+                {
+                    run_bytes += bytes;
+                    return;
+                }
+
+                flush();
+                write_zeros(data + offset - position);
+
+                // column nobody asked for yet, zero initialized anyway
+                if (source == nullptr)
+                {
+                    write_zeros(bytes);
+                    return;
+                }
+                run = source;
+                run_bytes = bytes; });
+    flush();
+
+    return std::fclose(file) == 0 && ok;
+}
+
+bool load_snapshot(char const *file_name)
+{
+    int const fd = open(file_name, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    bool const stat_ok = fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(snapshot_header);
+
+    // private mapping, units are updated in place without touching the file
+    void *const mapping = stat_ok ? mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    char *const base = static_cast<char *>(mapping);
+    auto const &header = *reinterpret_cast<snapshot_header const *>(base);
+    auto const components = reinterpret_cast<snapshot_component const *>(base + sizeof(snapshot_header));
+    auto const army_table = reinterpret_cast<snapshot_army const *>(components + header.m_components);
+
+    // components are registered at startup, same build registers same ones,
+    // tables are read only after they are known to end before the block, in the file
+    bool valid = std::memcmp(header.m_magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0 &&
+                 header.m_version == SNAPSHOT_VERSION && header.m_bytes == size_t(st.st_size) &&
+                 header.m_components == COMPONENTS.m_size && header.m_armies <= ARMIES_MAX_SIZE &&
+                 header.m_data <= header.m_bytes && header.m_data % block_alignment() == 0 &&
+                 sizeof(snapshot_header) + header.m_components * sizeof(snapshot_component) +
+                         header.m_armies * sizeof(snapshot_army) <=
+                     header.m_data;
+    for (unsigned c = 0; c < COMPONENTS.m_size && valid; ++c)
+    {
+        valid = components[c].m_element_size == COMPONENTS.m_info[c].m_element_size &&
+                components[c].m_alignment == COMPONENTS.m_info[c].m_alignment;
+    }
+    if (!valid)
+    {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+
+    std::vector<unsigned> sizes(header.m_armies);
+    for (unsigned a = 0; a < header.m_armies; ++a)
+    {
+        sizes[a] = army_table[a].m_size;
+    }
+    if (header.m_data + lay_out(0, sizes, [](size_t, size_t, unsigned, unsigned) {}) != header.m_bytes)
+    {
+        munmap(mapping, st.st_size);
+        return false;
+    }
+
+    for (unsigned a = 0; a < header.m_armies; ++a)
+    {
+        std::copy_n(army_table[a].m_rotation_offset, MODEL_KINDS, ARMY_INFO[a].m_rotation_offset);
+        // models of the saving run are not in any buffer of this one
+        std::fill_n(ARMY_INFO[a].m_destination, MODEL_KINDS, nullptr);
+    }
+
+    // snapshot replaces all armies, they are one block living in the mapping
+    ARMIES.m_columns = {};
+    BLOCKS_SIZE = 0;
+    add_block(0, sizes);
+
+    char *const data = base + header.m_data;
+    lay_out(0, sizes, [data](size_t offset, size_t, unsigned army_id, unsigned column)
+            { set_column(army_id, column, data + offset); });
+
+    if (SNAPSHOT != nullptr)
+        munmap(SNAPSHOT, SNAPSHOT_SIZE);
+    SNAPSHOT = mapping;
+    SNAPSHOT_SIZE = st.st_size;
+
+    return true;
+}
+
+void set_random_seed(std::uint64_t seed)
+{
+    RANDOM_SEED = seed;
+    for (unsigned a = 0; a < army::m_army_id; ++a)
+    {
+        seed_random(a);
+    }
+}
+
+std::uint64_t hash_world()
+{
+    std::uint64_t h = hash_bytes(army::m_army_id, nullptr, 0);
+    for (unsigned a = 0; a < army::m_army_id; ++a)
+    {
+        auto const army_size = ARMY_INFO[a].m_army_size;
+        h = hash_bytes(h, &army_size, sizeof(army_size));
+
+        for (unsigned c = 0; c < COMPONENTS.m_size; ++c)
+        {
+            // column never allocated is zeros, hashing does not allocate it
+            auto const &info = COMPONENTS.m_info[c];
+            if (!info.m_derived)
+                h = hash_bytes(h, ARMIES.m_columns[a][c], army_size * info.m_element_size);
+        }
+    }
+    return h;
+}
@@ -0,0 +1,334 @@
+#include <mov.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+    constexpr unsigned PATHS_MAX_SIZE = 16;
+
+    // searched segments around cached hint, units rarely pass more per tick
+    constexpr unsigned HINT_BACK = 1;
+    constexpr unsigned HINT_AHEAD = 4;
+
+    // points replaced by the last one remembered for simplification,
+    // point is kept when a longer straight run is recorded
+    constexpr unsigned SKIPPED_MAX_SIZE = 64;
+
+    struct path_data
+    {
+        std::vector<float> m_x;
+        std::vector<float> m_y;
+        // arc length from path start to point i
+        std::vector<float> m_length;
+        // bumped on clear, invalidates cached unit hints
+        unsigned m_generation;
+
+        // 0 - unbounded, otherwise oldest points are dropped above capacity
+        unsigned m_capacity;
+        // points before m_first are dropped, arrays are compacted once
+        // m_first reaches capacity, so they never grow past twice capacity
+        unsigned m_first;
+        // dropped since clear
+        unsigned m_dropped;
+
+        // recorded points replaced by last point since point before it
+        std::vector<glm::vec2> m_skipped;
+    };
+
+    std::array<path_data, PATHS_MAX_SIZE> PATHS;
+    unsigned PATHS_SIZE{0};
+
+#define PATH_EXIST(path_id) assert(path_id < PATHS_SIZE)
+
+    // segment (points i, i + 1) unit was closest to last time
+    component<unsigned> const PATH_SEGMENT = register_component<unsigned>();
+    // path / generation the hint belongs to, 0 - none
+    component<std::uint32_t> const PATH_KEY = register_component<std::uint32_t>();
+    component<glm::vec2> const PATH_TARGET = register_component<glm::vec2>();
+
+    std::uint32_t path_key(unsigned path_id)
+    {
+        return (PATHS[path_id].m_generation * PATHS_MAX_SIZE + path_id) + 1;
+    }
+
+    path_view view_of(path_data const &path)
+    {
+        return {path.m_x.data() + path.m_first,
+                path.m_y.data() + path.m_first,
+                path.m_length.data() + path.m_first,
+                unsigned(path.m_x.size()) - path.m_first,
+                path.m_generation,
+                path.m_dropped};
+    }
+
+    unsigned segment_count(path_view const &path)
+    {
+        return path.m_size > 1 ? path.m_size - 1 : 0;
+    }
+
+    // closest point of segment k, returns squared distance
+    float closest_on_segment(path_view const &path, unsigned k, glm::vec2 const p, float &distance)
+    {
+        glm::vec2 const a{path.m_x[k], path.m_y[k]};
+        glm::vec2 const d = glm::vec2{path.m_x[k + 1], path.m_y[k + 1]} - a;
+
+        float const len2 = glm::dot(d, d);
+        float const t = len2 > 0.0f ? glm::clamp(glm::dot(p - a, d) / len2, 0.0f, 1.0f) : 0.0f;
+
+        distance = path.m_length[k] + t * (path.m_length[k + 1] - path.m_length[k]);
+
+        glm::vec2 const c = a + t * d - p;
+        return glm::dot(c, c);
+    }
+
+    // closest segment in [first, last]
+    float closest_in_range(path_view const &path, unsigned first, unsigned last, glm::vec2 const p, unsigned &segment)
+    {
+        float best_d2{};
+        float best_distance{};
+        for (unsigned k = first; k <= last; ++k)
+        {
+            float distance;
+            float const d2 = closest_on_segment(path, k, p, distance);
+            if (k == first || d2 < best_d2)
+            {
+                best_d2 = d2;
+                best_distance = distance;
+                segment = k;
+            }
+        }
+        return best_distance;
+    }
+
+    void drop_oldest(path_data &path)
+    {
+        path.m_first++;
+        path.m_dropped++;
+
+        if (path.m_first >= path.m_capacity)
+        {
+            // arc length rebased to oldest kept point, it does not grow
+            // (and lose float precision) over a long session
+            float const origin = path.m_length[path.m_first];
+            path.m_x.erase(path.m_x.begin(), path.m_x.begin() + path.m_first);
+            path.m_y.erase(path.m_y.begin(), path.m_y.begin() + path.m_first);
+            path.m_length.erase(path.m_length.begin(), path.m_length.begin() + path.m_first);
+            for (auto &length : path.m_length)
+            {
+                length -= origin;
+            }
+            path.m_first = 0;
+        }
+    }
+
+    float segment_distance2(glm::vec2 const a, glm::vec2 const b, glm::vec2 const p)
+    {
+        glm::vec2 const d = b - a;
+        float const len2 = glm::dot(d, d);
+        float const t = len2 > 0.0f ? glm::clamp(glm::dot(p - a, d) / len2, 0.0f, 1.0f) : 0.0f;
+
+        glm::vec2 const c = a + t * d - p;
+        return glm::dot(c, c);
+    }
+
+    // last point can be replaced by new one when it, and every point
+    // it already replaced, stays within tolerance of the new last segment
+    bool can_replace_last(path_data const &path, glm::vec2 const point, float tolerance)
+    {
+        auto const size = path.m_x.size() - path.m_first;
+        if (size < 2 || path.m_skipped.size() >= SKIPPED_MAX_SIZE)
+            return false;
+
+        auto const n = path.m_x.size();
+        glm::vec2 const anchor{path.m_x[n - 2], path.m_y[n - 2]};
+        glm::vec2 const last{path.m_x[n - 1], path.m_y[n - 1]};
+
+        float const tolerance2 = tolerance * tolerance;
+        if (segment_distance2(anchor, point, last) > tolerance2)
+            return false;
+
+        return std::all_of(path.m_skipped.begin(), path.m_skipped.end(), [&](glm::vec2 const s)
+                           { return segment_distance2(anchor, point, s) <= tolerance2; });
+    }
+} // Anonymous NS
+
+unsigned create_path()
+{
+    assert(PATHS_SIZE < PATHS_MAX_SIZE);
+    return PATHS_SIZE++;
+}
+
+void add_path_point(unsigned path_id, glm::vec2 point)
+{
+    PATH_EXIST(path_id);
+    auto &path = PATHS[path_id];
+
+    // new last point, points replaced by the old one do not matter any more
+    path.m_skipped.clear();
+
+    float length{};
+    if (!path.m_x.empty())
+    {
+        length = path.m_length.back() +
+                 glm::length(point - glm::vec2{path.m_x.back(), path.m_y.back()});
+    }
+
+    path.m_x.push_back(point.x);
+    path.m_y.push_back(point.y);
+    path.m_length.push_back(length);
+
+    if (path.m_capacity > 0 && path.m_x.size() - path.m_first > path.m_capacity)
+    {
+        drop_oldest(path);
+    }
+}
+
+void set_path_capacity(unsigned path_id, unsigned capacity)
+{
+    PATH_EXIST(path_id);
+    assert(capacity == 0 || capacity >= 2);
+    auto &path = PATHS[path_id];
+
+    path.m_capacity = capacity;
+    path.m_x.reserve(2 * capacity);
+    path.m_y.reserve(2 * capacity);
+    path.m_length.reserve(2 * capacity);
+
+    while (capacity > 0 && path.m_x.size() - path.m_first > capacity)
+    {
+        drop_oldest(path);
+    }
+}
+
+void record_path_point(unsigned path_id, glm::vec2 point, float tolerance)
+{
+    PATH_EXIST(path_id);
+    auto &path = PATHS[path_id];
+
+    if (!can_replace_last(path, point, tolerance))
+    {
+        add_path_point(path_id, point);
+        return;
+    }
+
+    auto const n = path.m_x.size();
+    path.m_skipped.push_back({path.m_x[n - 1], path.m_y[n - 1]});
+
+    path.m_x[n - 1] = point.x;
+    path.m_y[n - 1] = point.y;
+    path.m_length[n - 1] = path.m_length[n - 2] +
+                           glm::length(point - glm::vec2{path.m_x[n - 2], path.m_y[n - 2]});
+}
+
+void clear_path(unsigned path_id)
+{
+    PATH_EXIST(path_id);
+    auto &path = PATHS[path_id];
+
+    path.m_x.clear();
+    path.m_y.clear();
+    path.m_length.clear();
+    path.m_skipped.clear();
+    path.m_first = 0;
+    path.m_dropped = 0;
+    path.m_generation++;
+}
+
+path_view get_path(unsigned path_id)
+{
+    PATH_EXIST(path_id);
+    return view_of(PATHS[path_id]);
+}
+
+float get_path_length(unsigned path_id)
+{
+    PATH_EXIST(path_id);
+    auto const path = view_of(PATHS[path_id]);
+
+    return path.m_size == 0 ? 0.0f : path.m_length[path.m_size - 1] - path.m_length[0];
+}
+
+float get_path_param(unsigned path_id, glm::vec2 position, unsigned &segment_hint)
+{
+    PATH_EXIST(path_id);
+    auto const path = view_of(PATHS[path_id]);
+
+    auto const segments = segment_count(path);
+    if (segments == 0)
+        return 0.0f;
+
+    unsigned const hint = std::min(segment_hint, segments - 1);
+    unsigned const first = hint > HINT_BACK ? hint - HINT_BACK : 0;
+    unsigned const last = std::min(hint + HINT_AHEAD, segments - 1);
+
+    return closest_in_range(path, first, last, position, segment_hint);
+}
+
+glm::vec2 get_path_position(unsigned path_id, float distance, unsigned &segment_hint)
+{
+    PATH_EXIST(path_id);
+    auto const path = view_of(PATHS[path_id]);
+
+    auto const segments = segment_count(path);
+    if (segments == 0)
+        return path.m_size == 0 ? glm::vec2{0.0f} : glm::vec2{path.m_x[0], path.m_y[0]};
+
+    // walk from hint, distances asked for move only a bit between calls
+    unsigned k = std::min(segment_hint, segments - 1);
+    while (k + 1 < segments && path.m_length[k + 1] < distance)
+        ++k;
+    while (k > 0 && path.m_length[k] > distance)
+        --k;
+    segment_hint = k;
+
+    float const segment_length = path.m_length[k + 1] - path.m_length[k];
+    float const t = segment_length > 0.0f
+                        ? glm::clamp((distance - path.m_length[k]) / segment_length, 0.0f, 1.0f)
+                        : 0.0f;
+
+    return glm::mix(glm::vec2{path.m_x[k], path.m_y[k]}, glm::vec2{path.m_x[k + 1], path.m_y[k + 1]}, t);
+}
+
+void follow_path(unsigned army_id, unsigned path_id, float path_offset)
+{
+    PATH_EXIST(path_id);
+    auto const path = view_of(PATHS[path_id]);
+
+    if (path.m_size == 0)
+        return;
+
+    auto const army_size = get_army_size(army_id);
+    auto const p = get_position(army_id);
+    auto segment = get_component(army_id, PATH_SEGMENT);
+    auto key = get_component(army_id, PATH_KEY);
+    auto target = get_component(army_id, PATH_TARGET);
+
+    auto const current_key = path_key(path_id);
+    auto const segments = segment_count(path);
+
+    for (unsigned i = 0; i < army_size; ++i)
+    {
+        // hints count dropped points too, they stay valid when path start is dropped
+        unsigned hint = segment[i] > path.m_dropped ? segment[i] - path.m_dropped : 0;
+
+        // new path for this unit, one full scan to seed the hint
+        if (key[i] != current_key && segments > 0)
+        {
+            closest_in_range(path, 0, segments - 1, p[i], hint);
+            key[i] = current_key;
+        }
+
+        float const distance = get_path_param(path_id, p[i], hint);
+        segment[i] = hint + path.m_dropped;
+
+        // point a bit further along the path, end of path is arrived at
+        unsigned ahead = hint;
+        target[i] = get_path_position(path_id, distance + path_offset, ahead);
+    }
+
+    dynamic_arrive(army_id, target);
+}
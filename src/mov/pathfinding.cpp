@@ -0,0 +1,434 @@
+#include <mov.h>
+
+#include "grid.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    constexpr unsigned GRIDS_MAX_SIZE = 4;
+
+    // cached paths per grid, cache is dropped when full
+    constexpr size_t CACHE_MAX_SIZE = 1 << 14;
+
+    // below that many searches a batch stays on calling thread
+    constexpr unsigned SEARCHES_PER_WORKER = 8;
+
+    struct grid_data
+    {
+        grid_info m_info;
+        std::vector<std::uint8_t> m_cost;
+        // cells with cost other than 0 / 1, JPS needs uniform cost
+        unsigned m_weighted;
+        unsigned m_generation;
+        // waypoint cells per (start cell, goal cell), empty - unreachable
+        std::unordered_map<std::uint64_t, std::vector<unsigned>> m_cache;
+    };
+
+    std::array<grid_data, GRIDS_MAX_SIZE> GRIDS;
+    unsigned GRIDS_SIZE{0};
+
+#define GRID_EXIST(grid_id) assert(grid_id < GRIDS_SIZE)
+
+    // results of last find_paths call
+    std::vector<glm::vec2> BATCH_POINTS;
+    std::vector<unsigned> BATCH_OFFSETS;
+
+    struct grid_view
+    {
+        grid_info const &m_info;
+        std::uint8_t const *m_cost;
+
+        bool walkable(int x, int y) const
+        {
+            return x >= 0 && y >= 0 && x < int(m_info.m_width) && y < int(m_info.m_height) &&
+                   m_cost[y * m_info.m_width + x] != 0;
+        }
+
+        unsigned cell(int x, int y) const { return y * m_info.m_width + x; }
+    };
+
+    bool a_star(grid_data const &grid, unsigned start, unsigned goal, search_scratch &s, std::vector<unsigned> &out)
+    {
+        auto const &info = grid.m_info;
+        grid_view const view{info, grid.m_cost.data()};
+
+        s.begin(grid.m_cost.size());
+        s.relax(start, NO_CELL, 0.0f, octile(info, start, goal));
+
+        for (unsigned c = s.pop(); c != NO_CELL; c = s.pop())
+        {
+            if (c == goal)
+            {
+                s.reconstruct(info, goal, out);
+                return true;
+            }
+
+            int const x = c % info.m_width;
+            int const y = c / info.m_width;
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                for (int dx = -1; dx <= 1; ++dx)
+                {
+                    if ((dx == 0 && dy == 0) || !view.walkable(x + dx, y + dy))
+                        continue;
+
+                    // no cutting corners
+                    bool const diagonal = dx != 0 && dy != 0;
+                    if (diagonal && !(view.walkable(x + dx, y) && view.walkable(x, y + dy)))
+                        continue;
+
+                    unsigned const n = view.cell(x + dx, y + dy);
+                    float const step = (diagonal ? SQRT2 : 1.0f) * grid.m_cost[n];
+                    s.relax(n, c, s.m_g[c] + step, octile(info, n, goal));
+                }
+            }
+        }
+        return false;
+    }
+
+    // Jump from (x, y) - (dx, dy) in given direction until a jump point,
+    // NO_CELL when running into obstacle. Diagonal moves never cut corners.
+    unsigned jump(grid_view const &view, int x, int y, int dx, int dy, unsigned goal)
+    {
+        for (;;)
+        {
+            if (!view.walkable(x, y))
+                return NO_CELL;
+
+            unsigned const c = view.cell(x, y);
+            if (c == goal)
+                return c;
+
+            if (dx != 0 && dy != 0)
+            {
+                if (jump(view, x + dx, y, dx, 0, goal) != NO_CELL ||
+                    jump(view, x, y + dy, 0, dy, goal) != NO_CELL)
+                    return c;
+            }
+            else if (dx != 0)
+            {
+                // forced neighbours
+                if ((view.walkable(x, y - 1) && !view.walkable(x - dx, y - 1)) ||
+                    (view.walkable(x, y + 1) && !view.walkable(x - dx, y + 1)))
+                    return c;
+            }
+            else
+            {
+                if ((view.walkable(x - 1, y) && !view.walkable(x - 1, y - dy)) ||
+                    (view.walkable(x + 1, y) && !view.walkable(x + 1, y - dy)))
+                    return c;
+            }
+
+            if (!(view.walkable(x + dx, y) && view.walkable(x, y + dy)))
+                return NO_CELL;
+
+            x += dx;
+            y += dy;
+        }
+    }
+
+    // uniform cost grids only
+    bool jps(grid_data const &grid, unsigned start, unsigned goal, search_scratch &s, std::vector<unsigned> &out)
+    {
+        auto const &info = grid.m_info;
+        grid_view const view{info, grid.m_cost.data()};
+
+        s.begin(grid.m_cost.size());
+        s.relax(start, NO_CELL, 0.0f, octile(info, start, goal));
+
+        std::array<std::array<int, 2>, 8> dirs;
+        for (unsigned c = s.pop(); c != NO_CELL; c = s.pop())
+        {
+            if (c == goal)
+            {
+                s.reconstruct(info, goal, out);
+                return true;
+            }
+
+            int const x = c % info.m_width;
+            int const y = c / info.m_width;
+
+            // pruned neighbours, depending on direction we came from
+            unsigned count = 0;
+            auto const add = [&](int dx, int dy)
+            { dirs[count++] = {dx, dy}; };
+
+            unsigned const parent = s.m_parent[c];
+            if (parent == NO_CELL)
+            {
+                for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx)
+                        if ((dx != 0 || dy != 0) && view.walkable(x + dx, y + dy) &&
+                            view.walkable(x + dx, y) && view.walkable(x, y + dy))
+                            add(dx, dy);
+            }
+            else
+            {
+                int const px = parent % info.m_width;
+                int const py = parent / info.m_width;
+                int const dx = (x > px) - (x < px);
+                int const dy = (y > py) - (y < py);
+
+                if (dx != 0 && dy != 0)
+                {
+                    bool const vertical = view.walkable(x, y + dy);
+                    bool const horizontal = view.walkable(x + dx, y);
+                    if (vertical)
+                        add(0, dy);
+                    if (horizontal)
+                        add(dx, 0);
+                    if (vertical && horizontal)
+                        add(dx, dy);
+                }
+                else if (dx != 0)
+                {
+                    bool const next = view.walkable(x + dx, y);
+                    bool const up = view.walkable(x, y + 1);
+                    bool const down = view.walkable(x, y - 1);
+                    if (next)
+                    {
+                        add(dx, 0);
+                        if (up)
+                            add(dx, 1);
+                        if (down)
+                            add(dx, -1);
+                    }
+                    if (up)
+                        add(0, 1);
+                    if (down)
+                        add(0, -1);
+                }
+                else
+                {
+                    bool const next = view.walkable(x, y + dy);
+                    bool const right = view.walkable(x + 1, y);
+                    bool const left = view.walkable(x - 1, y);
+                    if (next)
+                    {
+                        add(0, dy);
+                        if (right)
+                            add(1, dy);
+                        if (left)
+                            add(-1, dy);
+                    }
+                    if (right)
+                        add(1, 0);
+                    if (left)
+                        add(-1, 0);
+                }
+            }
+
+            for (unsigned i = 0; i < count; ++i)
+            {
+                auto const [dx, dy] = dirs[i];
+                unsigned const jp = jump(view, x + dx, y + dy, dx, dy, goal);
+                if (jp != NO_CELL)
+                {
+                    s.relax(jp, c, s.m_g[c] + octile(info, c, jp), octile(info, jp, goal));
+                }
+            }
+        }
+        return false;
+    }
+
+    std::uint64_t cache_key(unsigned start, unsigned goal)
+    {
+        return (std::uint64_t{start} << 32) | goal;
+    }
+
+    // searches run on worker threads, each with own scratch,
+    // caller waits for all of them
+    void run_searches(grid_data const &grid, std::uint64_t const *keys, std::vector<unsigned> *results,
+                      unsigned count, path_search search)
+    {
+        static std::vector<search_scratch> scratch;
+
+        unsigned const hardware = std::max(std::thread::hardware_concurrency(), 1u);
+        unsigned const workers = std::clamp(count / SEARCHES_PER_WORKER, 1u, hardware);
+        scratch.resize(std::max<size_t>(scratch.size(), workers));
+
+        // JPS is only optimal when every walkable cell costs the same
+        bool const use_jps = search == path_search::jps && grid.m_weighted == 0;
+
+        std::atomic<unsigned> next{0};
+        auto const work = [&](unsigned worker)
+        {
+            for (unsigned i = next++; i < count; i = next++)
+            {
+                unsigned const start = unsigned(keys[i] >> 32);
+                unsigned const goal = unsigned(keys[i]);
+
+                // pruning assumes we come from walkable cells,
+                // unit stuck in a blocked one gets plain A*
+                bool const found = use_jps && grid.m_cost[start] != 0
+                                       ? jps(grid, start, goal, scratch[worker], results[i])
+                                       : a_star(grid, start, goal, scratch[worker], results[i]);
+                if (!found)
+                    results[i].clear();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned w = 1; w < workers; ++w)
+        {
+            threads.emplace_back(work, w);
+        }
+        work(0);
+
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+} // Anonymous NS
+
+unsigned create_grid(unsigned width, unsigned height, glm::vec2 origin, float cell_size)
+{
+    assert(GRIDS_SIZE < GRIDS_MAX_SIZE);
+    assert(width > 0 && height > 0);
+
+    auto &grid = GRIDS[GRIDS_SIZE];
+    grid.m_info = {width, height, origin, cell_size};
+    grid.m_cost.assign(width * height, 1);
+    grid.m_weighted = 0;
+
+    return GRIDS_SIZE++;
+}
+
+grid_info get_grid_info(unsigned grid_id)
+{
+    GRID_EXIST(grid_id);
+    return GRIDS[grid_id].m_info;
+}
+
+void set_cell_cost(unsigned grid_id, unsigned x, unsigned y, std::uint8_t cost)
+{
+    GRID_EXIST(grid_id);
+    auto &grid = GRIDS[grid_id];
+    assert(x < grid.m_info.m_width && y < grid.m_info.m_height);
+
+    auto &current = grid.m_cost[y * grid.m_info.m_width + x];
+    if (current == cost)
+        return;
+
+    grid.m_weighted -= current > 1;
+    grid.m_weighted += cost > 1;
+    current = cost;
+    grid.m_generation++;
+
+    // cached paths can go through changed cell
+    grid.m_cache.clear();
+}
+
+std::uint8_t const *get_grid_costs(unsigned grid_id)
+{
+    GRID_EXIST(grid_id);
+    return GRIDS[grid_id].m_cost.data();
+}
+
+unsigned get_grid_generation(unsigned grid_id)
+{
+    GRID_EXIST(grid_id);
+    return GRIDS[grid_id].m_generation;
+}
+
+std::uint8_t get_cell_cost(unsigned grid_id, unsigned x, unsigned y)
+{
+    GRID_EXIST(grid_id);
+    auto const &grid = GRIDS[grid_id];
+    assert(x < grid.m_info.m_width && y < grid.m_info.m_height);
+
+    return grid.m_cost[y * grid.m_info.m_width + x];
+}
+
+path_batch find_paths(unsigned grid_id, path_query const *queries, unsigned count, path_search search)
+{
+    GRID_EXIST(grid_id);
+    auto &grid = GRIDS[grid_id];
+    auto const &info = grid.m_info;
+
+    static std::vector<std::uint64_t> keys;
+    static std::vector<std::uint64_t> missing;
+    static std::vector<std::vector<unsigned>> results;
+
+    keys.resize(count);
+    missing.clear();
+
+    // units ordered together mostly share start / goal cells,
+    // every distinct pair is searched once
+    for (unsigned i = 0; i < count; ++i)
+    {
+        keys[i] = cache_key(cell_of(info, queries[i].m_start), cell_of(info, queries[i].m_goal));
+        if (!grid.m_cache.contains(keys[i]))
+        {
+            missing.push_back(keys[i]);
+        }
+    }
+
+    // evicted before search, hits of this batch are evicted too and searched again
+    if (grid.m_cache.size() + missing.size() > CACHE_MAX_SIZE)
+    {
+        grid.m_cache.clear();
+        missing.assign(keys.begin(), keys.end());
+    }
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+    results.resize(std::max(results.size(), missing.size()));
+    run_searches(grid, missing.data(), results.data(), unsigned(missing.size()), search);
+
+    for (size_t i = 0; i < missing.size(); ++i)
+    {
+        grid.m_cache[missing[i]] = results[i];
+    }
+
+    BATCH_POINTS.clear();
+    BATCH_OFFSETS.assign(1, 0);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        auto const found = grid.m_cache.find(keys[i]);
+        assert(found != grid.m_cache.end());
+        auto const &cells = found->second;
+
+        // start cell is where unit already is, goal is exact
+        for (size_t k = 1; k < cells.size(); ++k)
+        {
+            BATCH_POINTS.push_back(cell_centre(info, cells[k]));
+        }
+        if (!cells.empty())
+        {
+            if (cells.size() == 1)
+                BATCH_POINTS.push_back(queries[i].m_goal);
+            BATCH_POINTS.back() = queries[i].m_goal;
+        }
+
+        BATCH_OFFSETS.push_back(unsigned(BATCH_POINTS.size()));
+    }
+
+    return {BATCH_POINTS.data(), BATCH_OFFSETS.data(), count};
+}
+
+bool find_path(unsigned grid_id, glm::vec2 start, glm::vec2 goal, unsigned path_id, path_search search)
+{
+    path_query const query{start, goal};
+    path_batch const batch = find_paths(grid_id, &query, 1, search);
+
+    clear_path(path_id);
+    if (batch.m_offsets[1] == 0)
+        return false;
+
+    add_path_point(path_id, start);
+    for (unsigned i = batch.m_offsets[0]; i < batch.m_offsets[1]; ++i)
+    {
+        add_path_point(path_id, batch.m_points[i]);
+    }
+    return true;
+}
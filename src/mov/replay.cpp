@@ -0,0 +1,612 @@
+#include <mov.h>
+
+#include "angle.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    constexpr char REPLAY_MAGIC[8] = {'M', 'O', 'V', 'R', 'E', 'P', 'L', '\0'};
+    constexpr char INDEX_MAGIC[8] = {'M', 'O', 'V', 'R', 'I', 'D', 'X', '\0'};
+    constexpr std::uint32_t REPLAY_VERSION = 1;
+
+    // 1/256 of a unit, orientation in 1/65536 of a turn
+    constexpr float POSITION_SCALE = 256.0f;
+    constexpr float ORIENTATION_SCALE = 65536.0f * angle::INV_TWO_PI;
+
+    // ticks captured but not written yet, recording waits when all are taken
+    constexpr unsigned QUEUE_FRAMES = 4;
+
+    // Frame on disk: type, varint payload size, payload.
+    // keyframe : tick, army count, army sizes, x y o of every unit
+    // delta    : tick, then (unchanged units, x y o deltas of next unit) pairs
+    // index    : keyframe count, (tick, file offset) deltas, written on stop,
+    //            followed by its offset and INDEX_MAGIC
+    enum frame_type : std::uint8_t
+    {
+        KEYFRAME = 'K',
+        DELTA = 'D',
+        INDEX = 'I'
+    };
+
+    struct replay_header
+    {
+        char m_magic[8];
+        std::uint32_t m_version;
+        float m_position_scale;
+        float m_orientation_scale;
+        std::uint32_t m_reserved;
+    };
+
+    struct replay_trailer
+    {
+        std::uint64_t m_index;
+        char m_magic[8];
+    };
+
+    std::uint32_t zigzag(std::int32_t v)
+    {
+        return (std::uint32_t(v) << 1) ^ std::uint32_t(v >> 31);
+    }
+
+    std::int32_t unzigzag(std::uint32_t v)
+    {
+        return std::int32_t(v >> 1) ^ -std::int32_t(v & 1);
+    }
+
+    void put_varint(std::vector<std::uint8_t> &out, std::uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out.push_back(std::uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(std::uint8_t(v));
+    }
+
+    bool get_varint(std::uint8_t const *&p, std::uint8_t const *end, std::uint64_t &v)
+    {
+        v = 0;
+        for (unsigned shift = 0; p != end && shift < 64; shift += 7)
+        {
+            std::uint8_t const byte = *p++;
+            v |= std::uint64_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    bool read_varint(std::FILE *file, std::uint64_t &v)
+    {
+        v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7)
+        {
+            int const byte = std::fgetc(file);
+            if (byte == EOF)
+                return false;
+            v |= std::uint64_t(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    // x, y, orientation of every unit of every army
+    struct quantized_frame
+    {
+        unsigned m_tick;
+        std::vector<unsigned> m_sizes;
+        std::vector<std::int32_t> m_values;
+    };
+
+    struct replay_writer
+    {
+        std::FILE *m_file{};
+        unsigned m_keyframe_interval;
+        unsigned m_tick;
+
+        // frames queued for the writer thread, m_count from m_head on
+        std::array<quantized_frame, QUEUE_FRAMES> m_frames;
+        unsigned m_head;
+        unsigned m_count;
+        bool m_stop;
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::thread m_thread;
+
+        // writer thread only
+        std::vector<unsigned> m_previous_sizes;
+        std::vector<std::int32_t> m_previous;
+        std::vector<std::uint8_t> m_bytes;
+        std::vector<std::pair<unsigned, std::uint64_t>> m_keyframes;
+        std::uint64_t m_offset;
+        bool m_ok;
+    } WRITER;
+
+    void write_frame(replay_writer &w, frame_type type)
+    {
+        std::vector<std::uint8_t> head{type};
+        put_varint(head, w.m_bytes.size());
+
+        w.m_ok = w.m_ok && std::fwrite(head.data(), 1, head.size(), w.m_file) == head.size() &&
+                 std::fwrite(w.m_bytes.data(), 1, w.m_bytes.size(), w.m_file) == w.m_bytes.size();
+        w.m_offset += head.size() + w.m_bytes.size();
+    }
+
+    void encode(replay_writer &w, quantized_frame const &frame)
+    {
+        auto &out = w.m_bytes;
+        out.clear();
+        put_varint(out, frame.m_tick);
+
+        // armies added or resized, deltas would not line up
+        bool const key = frame.m_tick % w.m_keyframe_interval == 0 || frame.m_sizes != w.m_previous_sizes;
+        if (key)
+        {
+            w.m_keyframes.push_back({frame.m_tick, w.m_offset});
+
+            put_varint(out, frame.m_sizes.size());
+            for (auto const size : frame.m_sizes)
+            {
+                put_varint(out, size);
+            }
+            for (auto const value : frame.m_values)
+            {
+                put_varint(out, zigzag(value));
+            }
+        }
+        else
+        {
+            // units standing still cost one byte per run of them
+            auto const &previous = w.m_previous;
+            unsigned unchanged{};
+            for (size_t i = 0; i < frame.m_values.size(); i += 3)
+            {
+                std::int32_t const dx = frame.m_values[i] - previous[i];
+                std::int32_t const dy = frame.m_values[i + 1] - previous[i + 1];
+                std::int32_t const d_o = std::int16_t(frame.m_values[i + 2] - previous[i + 2]);
+                if (dx == 0 && dy == 0 && d_o == 0)
+                {
+                    ++unchanged;
+                    continue;
+                }
+
+                put_varint(out, unchanged);
+                put_varint(out, zigzag(dx));
+                put_varint(out, zigzag(dy));
+                put_varint(out, zigzag(d_o));
+                unchanged = 0;
+            }
+            if (unchanged > 0)
+                put_varint(out, unchanged);
+        }
+
+        write_frame(w, key ? KEYFRAME : DELTA);
+        w.m_previous_sizes = frame.m_sizes;
+        w.m_previous = frame.m_values;
+    }
+
+    void write_index(replay_writer &w)
+    {
+        auto &out = w.m_bytes;
+        out.clear();
+
+        std::uint64_t const index = w.m_offset;
+        put_varint(out, w.m_keyframes.size());
+
+        std::pair<unsigned, std::uint64_t> previous{};
+        for (auto const &keyframe : w.m_keyframes)
+        {
+            put_varint(out, keyframe.first - previous.first);
+            put_varint(out, keyframe.second - previous.second);
+            previous = keyframe;
+        }
+        write_frame(w, INDEX);
+
+        replay_trailer trailer{index, {}};
+        std::copy_n(INDEX_MAGIC, sizeof(INDEX_MAGIC), trailer.m_magic);
+        w.m_ok = w.m_ok && std::fwrite(&trailer, sizeof(trailer), 1, w.m_file) == 1;
+    }
+
+    void writer_thread(replay_writer &w)
+    {
+        for (;;)
+        {
+            std::unique_lock lock{w.m_mutex};
+            w.m_changed.wait(lock, [&w]()
+                             { return w.m_count > 0 || w.m_stop; });
+            if (w.m_count == 0)
+                return;
+
+            // producer never touches queued frames, encoded without the lock
+            auto const &frame = w.m_frames[w.m_head];
+            lock.unlock();
+
+            encode(w, frame);
+
+            lock.lock();
+            w.m_head = (w.m_head + 1) % QUEUE_FRAMES;
+            w.m_count--;
+            w.m_changed.notify_all();
+        }
+    }
+
+    void quantize(quantized_frame &frame)
+    {
+        unsigned const armies = get_army_count();
+        frame.m_sizes.resize(armies);
+
+        size_t units{};
+        for (unsigned a = 0; a < armies; ++a)
+        {
+            frame.m_sizes[a] = get_army_size(a);
+            units += frame.m_sizes[a];
+        }
+        frame.m_values.resize(units * 3);
+
+        auto *out = frame.m_values.data();
+        for (unsigned a = 0; a < armies; ++a)
+        {
+            auto const p = get_position(a);
+            auto const o = get_orientation(a);
+            for (unsigned i = 0; i < frame.m_sizes[a]; ++i)
+            {
+                *out++ = std::int32_t(std::lround(p[i].x * POSITION_SCALE));
+                *out++ = std::int32_t(std::lround(p[i].y * POSITION_SCALE));
+                *out++ = std::int16_t(std::lround(angle::wrap(o[i]) * ORIENTATION_SCALE));
+            }
+        }
+    }
+
+    struct replay_reader
+    {
+        std::FILE *m_file{};
+        std::uint64_t m_end;
+        std::vector<std::pair<unsigned, std::uint64_t>> m_keyframes;
+
+        // offset of the frame read next
+        std::uint64_t m_next;
+        std::vector<std::uint8_t> m_bytes;
+
+        // last frame read
+        bool m_has_frame;
+        unsigned m_tick;
+        std::vector<unsigned> m_offsets;
+        std::vector<std::int32_t> m_values;
+        std::vector<glm::vec2> m_position;
+        std::vector<float> m_orientation;
+    } READER;
+
+    bool read_frame_head(replay_reader &r, std::uint8_t &type, std::uint64_t &size)
+    {
+        if (r.m_next >= r.m_end || std::fseek(r.m_file, long(r.m_next), SEEK_SET) != 0)
+            return false;
+
+        int const t = std::fgetc(r.m_file);
+        if (t == EOF || !read_varint(r.m_file, size))
+            return false;
+        type = std::uint8_t(t);
+        return true;
+    }
+
+    // index from the end of file, or found by walking frame heads
+    // when recording did not finish
+    void read_index(replay_reader &r, std::uint64_t data, std::uint64_t file_size)
+    {
+        r.m_keyframes.clear();
+
+        replay_trailer trailer;
+        bool const finished = file_size >= data + sizeof(trailer) &&
+                              std::fseek(r.m_file, long(file_size - sizeof(trailer)), SEEK_SET) == 0 &&
+                              std::fread(&trailer, sizeof(trailer), 1, r.m_file) == 1 &&
+                              std::memcmp(trailer.m_magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+                              trailer.m_index >= data && trailer.m_index < file_size;
+        if (finished)
+        {
+            r.m_next = trailer.m_index;
+            r.m_end = file_size;
+
+            std::uint8_t type;
+            std::uint64_t size;
+            if (read_frame_head(r, type, size) && type == INDEX)
+            {
+                r.m_bytes.resize(size);
+                if (std::fread(r.m_bytes.data(), 1, size, r.m_file) == size)
+                {
+                    std::uint8_t const *p = r.m_bytes.data();
+                    std::uint8_t const *const end = p + size;
+
+                    std::uint64_t count{}, tick{}, offset{};
+                    get_varint(p, end, count);
+                    for (std::uint64_t k = 0; k < count; ++k)
+                    {
+                        std::uint64_t dt, d_offset;
+                        if (!get_varint(p, end, dt) || !get_varint(p, end, d_offset))
+                            break;
+                        tick += dt;
+                        offset += d_offset;
+                        r.m_keyframes.push_back({unsigned(tick), offset});
+                    }
+                    r.m_end = trailer.m_index;
+                    return;
+                }
+            }
+        }
+
+        r.m_keyframes.clear();
+        r.m_end = file_size;
+        r.m_next = data;
+        for (;;)
+        {
+            std::uint64_t const offset = r.m_next;
+            std::uint8_t type;
+            std::uint64_t size;
+            if (!read_frame_head(r, type, size) || (type != KEYFRAME && type != DELTA))
+                break;
+
+            std::uint64_t const payload = std::uint64_t(std::ftell(r.m_file));
+            if (payload + size > file_size)
+                break;
+
+            std::uint64_t tick;
+            if (type == KEYFRAME && read_varint(r.m_file, tick))
+                r.m_keyframes.push_back({unsigned(tick), offset});
+            r.m_next = payload + size;
+        }
+        r.m_end = r.m_next;
+    }
+
+    bool decode(replay_reader &r, std::uint8_t type)
+    {
+        std::uint8_t const *p = r.m_bytes.data();
+        std::uint8_t const *const end = p + r.m_bytes.size();
+
+        std::uint64_t v;
+        if (!get_varint(p, end, v))
+            return false;
+        r.m_tick = unsigned(v);
+
+        if (type == KEYFRAME)
+        {
+            std::uint64_t armies;
+            if (!get_varint(p, end, armies))
+                return false;
+
+            r.m_offsets.assign(1, 0);
+            for (std::uint64_t a = 0; a < armies; ++a)
+            {
+                if (!get_varint(p, end, v))
+                    return false;
+                r.m_offsets.push_back(r.m_offsets.back() + unsigned(v));
+            }
+
+            r.m_values.resize(size_t(r.m_offsets.back()) * 3);
+            for (auto &value : r.m_values)
+            {
+                if (!get_varint(p, end, v))
+                    return false;
+                value = unzigzag(std::uint32_t(v));
+            }
+        }
+        else
+        {
+            // delta needs the frame before it
+            if (!r.m_has_frame)
+                return false;
+
+            size_t const units = r.m_values.size() / 3;
+            for (size_t u = 0; u < units;)
+            {
+                if (!get_varint(p, end, v))
+                    return false;
+                u += v;
+                if (u >= units)
+                    break;
+
+                for (unsigned k = 0; k < 3; ++k)
+                {
+                    if (!get_varint(p, end, v))
+                        return false;
+                    r.m_values[u * 3 + k] += unzigzag(std::uint32_t(v));
+                }
+                r.m_values[u * 3 + 2] = std::int16_t(r.m_values[u * 3 + 2]);
+                ++u;
+            }
+        }
+
+        size_t const units = r.m_values.size() / 3;
+        r.m_position.resize(units);
+        r.m_orientation.resize(units);
+        for (size_t u = 0; u < units; ++u)
+        {
+            r.m_position[u] = glm::vec2{float(r.m_values[u * 3]), float(r.m_values[u * 3 + 1])} / POSITION_SCALE;
+            r.m_orientation[u] = float(r.m_values[u * 3 + 2]) / ORIENTATION_SCALE;
+        }
+        return true;
+    }
+
+    bool read_frame(replay_reader &r)
+    {
+        std::uint8_t type;
+        std::uint64_t size;
+        if (!read_frame_head(r, type, size) || (type != KEYFRAME && type != DELTA))
+            return false;
+
+        r.m_bytes.resize(size);
+        if (std::fread(r.m_bytes.data(), 1, size, r.m_file) != size)
+            return false;
+        r.m_next = std::uint64_t(std::ftell(r.m_file));
+
+        r.m_has_frame = decode(r, type);
+        return r.m_has_frame;
+    }
+} // Anonymous NS
+
+bool start_replay(char const *file_name, unsigned keyframe_interval)
+{
+    auto &w = WRITER;
+    assert(w.m_file == nullptr);
+    assert(keyframe_interval > 0);
+
+    w.m_file = std::fopen(file_name, "wb");
+    if (w.m_file == nullptr)
+        return false;
+
+    replay_header header{{}, REPLAY_VERSION, POSITION_SCALE, ORIENTATION_SCALE, 0};
+    std::copy_n(REPLAY_MAGIC, sizeof(REPLAY_MAGIC), header.m_magic);
+    w.m_ok = std::fwrite(&header, sizeof(header), 1, w.m_file) == 1;
+    w.m_offset = sizeof(header);
+
+    w.m_keyframe_interval = keyframe_interval;
+    w.m_tick = 0;
+    w.m_head = 0;
+    w.m_count = 0;
+    w.m_stop = false;
+    w.m_previous_sizes.clear();
+    w.m_keyframes.clear();
+    w.m_thread = std::thread{writer_thread, std::ref(w)};
+
+    return true;
+}
+
+void record_replay_tick()
+{
+    auto &w = WRITER;
+    if (w.m_file == nullptr)
+        return;
+
+    std::unique_lock lock{w.m_mutex};
+    w.m_changed.wait(lock, [&w]()
+                     { return w.m_count < QUEUE_FRAMES; });
+    auto &frame = w.m_frames[(w.m_head + w.m_count) % QUEUE_FRAMES];
+    lock.unlock();
+
+    frame.m_tick = w.m_tick++;
+    quantize(frame);
+
+    lock.lock();
+    w.m_count++;
+    w.m_changed.notify_all();
+}
+
+bool stop_replay()
+{
+    auto &w = WRITER;
+    if (w.m_file == nullptr)
+        return false;
+
+    {
+        std::lock_guard lock{w.m_mutex};
+        w.m_stop = true;
+        w.m_changed.notify_all();
+    }
+    w.m_thread.join();
+
+    write_index(w);
+    bool const ok = std::fclose(w.m_file) == 0 && w.m_ok;
+    w.m_file = nullptr;
+    return ok;
+}
+
+bool is_replay_recording()
+{
+    return WRITER.m_file != nullptr;
+}
+
+bool open_replay(char const *file_name)
+{
+    close_replay();
+
+    auto &r = READER;
+    r.m_file = std::fopen(file_name, "rb");
+    if (r.m_file == nullptr)
+        return false;
+
+    replay_header header;
+    bool const valid = std::fread(&header, sizeof(header), 1, r.m_file) == 1 &&
+                       std::memcmp(header.m_magic, REPLAY_MAGIC, sizeof(REPLAY_MAGIC)) == 0 &&
+                       header.m_version == REPLAY_VERSION && header.m_position_scale == POSITION_SCALE &&
+                       header.m_orientation_scale == ORIENTATION_SCALE && std::fseek(r.m_file, 0, SEEK_END) == 0;
+    if (!valid)
+    {
+        close_replay();
+        return false;
+    }
+
+    read_index(r, sizeof(header), std::uint64_t(std::ftell(r.m_file)));
+    r.m_has_frame = false;
+    r.m_next = r.m_keyframes.empty() ? r.m_end : r.m_keyframes.front().second;
+
+    return read_frame(r);
+}
+
+void close_replay()
+{
+    auto &r = READER;
+    if (r.m_file != nullptr)
+        std::fclose(r.m_file);
+    r.m_file = nullptr;
+    r.m_has_frame = false;
+}
+
+unsigned get_replay_keyframe_count()
+{
+    return unsigned(READER.m_keyframes.size());
+}
+
+unsigned get_replay_keyframe_tick(unsigned keyframe)
+{
+    assert(keyframe < READER.m_keyframes.size());
+    return READER.m_keyframes[keyframe].first;
+}
+
+bool seek_replay(unsigned tick)
+{
+    auto &r = READER;
+    assert(r.m_file != nullptr);
+
+    // last keyframe at or before tick, then deltas up to it
+    auto const keyframe = std::upper_bound(r.m_keyframes.begin(), r.m_keyframes.end(), tick,
+                                           [](unsigned t, auto const &k)
+                                           { return t < k.first; });
+    if (keyframe == r.m_keyframes.begin())
+        return false;
+
+    r.m_next = std::prev(keyframe)->second;
+    r.m_has_frame = false;
+    while (read_frame(r))
+    {
+        if (r.m_tick >= tick)
+            return r.m_tick == tick;
+    }
+    return false;
+}
+
+bool next_replay_tick()
+{
+    auto &r = READER;
+    assert(r.m_file != nullptr);
+    return r.m_has_frame && read_frame(r);
+}
+
+replay_frame get_replay_frame()
+{
+    auto const &r = READER;
+    assert(r.m_has_frame);
+
+    return {r.m_tick, unsigned(r.m_offsets.size() - 1), r.m_offsets.data(), r.m_position.data(),
+            r.m_orientation.data()};
+}
@@ -0,0 +1,139 @@
+#include <utils.h>
+#include <cassert>
+#include <vector>
+
+namespace
+{
+    // same layout as DrawArraysIndirectCommand
+    struct draw_command
+    {
+        unsigned m_count;
+        unsigned m_instance_count;
+        unsigned m_first;
+        unsigned m_base_instance;
+    };
+
+    constexpr unsigned LOCAL_SIZE = 64;
+    // size of lod_distances in cull_compute.txt
+    constexpr unsigned LODS_MAX_SIZE = 8;
+
+    unsigned create_storage(unsigned size, void const* data)
+    {
+        unsigned ssbo{};
+        glGenBuffers(1, &ssbo);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
+        return ssbo;
+    }
+} // Anonymous NS
+
+model_buffer::model_buffer(unsigned capacity)
+:m_ssbo{create_storage(capacity * sizeof(glm::mat4), nullptr)}
+{
+}
+
+void model_buffer::write(glm::mat4 const* models, unsigned first, unsigned count)
+{
+    if (count == 0)
+        return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(glm::mat4), count * sizeof(glm::mat4), models + first);
+}
+
+void model_buffer::bind(unsigned binding) const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_ssbo);
+}
+
+instance_buffer::instance_buffer(unsigned capacity)
+:m_ssbo{create_storage(capacity * sizeof(unsigned), nullptr)}
+{
+}
+
+void instance_buffer::write(unsigned const* values, unsigned first, unsigned count)
+{
+    if (count == 0)
+        return;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ssbo);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(unsigned), count * sizeof(unsigned), values + first);
+}
+
+void instance_buffer::bind(unsigned binding) const
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_ssbo);
+}
+
+gpu_culling::gpu_culling(unsigned capacity, unsigned lods, unsigned glyphs)
+:m_capacity{capacity},
+m_lods{lods},
+m_glyphs{glyphs},
+m_compute{"./shaders/cull_compute.txt"}
+{
+    assert(lods > 0 && lods <= LODS_MAX_SIZE);
+
+    m_visible = create_storage(capacity * lods * sizeof(unsigned), nullptr);
+    m_counts = create_storage(lods * sizeof(unsigned), nullptr);
+
+    std::vector<draw_command> commands(glyphs * lods, draw_command{});
+    m_commands = create_storage(commands.size() * sizeof(draw_command), commands.data());
+}
+
+void gpu_culling::set_glyph_lod(unsigned glyph, unsigned lod, unsigned first, unsigned count)
+{
+    assert(glyph < m_glyphs && lod < m_lods);
+
+    draw_command const command{count, 0, first, 0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commands);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, (glyph * m_lods + lod) * sizeof(draw_command), sizeof(draw_command), &command);
+}
+
+void gpu_culling::cull(model_buffer const& models, unsigned count, glm::mat4 const& view_projection,
+    glm::vec3 const& camera, float radius, float const* lod_distances)
+{
+    assert(count <= m_capacity);
+
+    unsigned const zeros[LODS_MAX_SIZE]{};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counts);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_lods * sizeof(unsigned), zeros);
+
+    models.bind(0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_visible);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_counts);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_commands);
+
+    m_compute.use_program();
+    m_compute.set_uniform("instances", count);
+    m_compute.set_uniform("capacity", m_capacity);
+    m_compute.set_uniform("lods", m_lods);
+    m_compute.set_uniform("commands_size", m_glyphs * m_lods);
+    m_compute.set_uniform("view_projection", view_projection);
+    m_compute.set_uniform("camera", camera);
+    m_compute.set_uniform("radius", radius);
+    if (m_lods > 1)
+    {
+        m_compute.set_uniform("lod_distances", lod_distances, m_lods - 1);
+    }
+
+    m_compute.set_uniform("pass", 0u);
+    glDispatchCompute((count + LOCAL_SIZE - 1) / LOCAL_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    m_compute.set_uniform("pass", 1u);
+    glDispatchCompute((m_glyphs * m_lods + LOCAL_SIZE - 1) / LOCAL_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void gpu_culling::draw(shader& program, model_buffer const& models, GLenum mode, unsigned glyph, unsigned lod)
+{
+    assert(glyph < m_glyphs && lod < m_lods);
+
+    models.bind(0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_visible);
+
+    program.set_uniform("lod_offset", lod * m_capacity);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commands);
+    glDrawArraysIndirect(mode, reinterpret_cast<void const*>(uintptr_t((glyph * m_lods + lod) * sizeof(draw_command))));
+}
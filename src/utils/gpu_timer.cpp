@@ -0,0 +1,143 @@
+#ifdef __PROFILE__
+
+#include <utils.h>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <iomanip>
+
+namespace
+{
+    constexpr unsigned PASSES_MAX_SIZE = 32;
+
+    // queries in flight per pass, result of frame n is read in frame n + 2
+    constexpr unsigned QUERIES = 2;
+
+    // results kept for summary
+    constexpr unsigned RESULTS_SIZE = 128;
+
+    struct gpu_pass
+    {
+        char const* m_name;
+        std::array<unsigned, QUERIES> m_queries;
+        std::array<bool, QUERIES> m_pending;
+        unsigned m_next;
+        bool m_warm;
+
+        std::array<unsigned long long, RESULTS_SIZE> m_results;
+        unsigned long long m_results_written;
+    };
+
+    std::array<gpu_pass, PASSES_MAX_SIZE> PASSES;
+    unsigned PASSES_SIZE{0};
+
+    // GL_TIME_ELAPSED queries can not nest
+    bool QUERY_ACTIVE{};
+
+    gpu_pass& find_pass(char const* name)
+    {
+        for (unsigned i = 0; i < PASSES_SIZE; ++i)
+        {
+            if (PASSES[i].m_name == name || std::strcmp(PASSES[i].m_name, name) == 0)
+                return PASSES[i];
+        }
+
+        assert(PASSES_SIZE < PASSES_MAX_SIZE);
+        auto& pass = PASSES[PASSES_SIZE++];
+        pass.m_name = name;
+        glGenQueries(QUERIES, pass.m_queries.data());
+        return pass;
+    }
+
+    // true when slot can take new query
+    bool collect(gpu_pass& pass, unsigned slot)
+    {
+        if (!pass.m_pending[slot])
+            return true;
+
+        int available{};
+        glGetQueryObjectiv(pass.m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+
+        GLuint64 elapsed{};
+        glGetQueryObjectui64v(pass.m_queries[slot], GL_QUERY_RESULT, &elapsed);
+        pass.m_pending[slot] = false;
+
+        // first query may include driver warm up (llvmpipe reports time since start)
+        if (!pass.m_warm)
+        {
+            pass.m_warm = true;
+            return true;
+        }
+
+        pass.m_results[pass.m_results_written++ % RESULTS_SIZE] = elapsed;
+        return true;
+    }
+} // Anonymous NS
+
+gpu_zone::gpu_zone(char const* name)
+:m_query{}
+{
+    // nested zone, time goes to enclosing one
+    if (QUERY_ACTIVE)
+        return;
+
+    auto& pass = find_pass(name);
+    unsigned const slot = pass.m_next;
+
+    // gpu is more than QUERIES frames behind, pass is not timed this frame
+    // rather than stalling on old result
+    if (!collect(pass, slot))
+        return;
+
+    pass.m_pending[slot] = true;
+    pass.m_next = (slot + 1) % QUERIES;
+
+    m_query = pass.m_queries[slot];
+    glBeginQuery(GL_TIME_ELAPSED, m_query);
+    QUERY_ACTIVE = true;
+}
+
+gpu_zone::~gpu_zone()
+{
+    if (m_query == 0)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    QUERY_ACTIVE = false;
+}
+
+void print_gpu_summary(std::ostream& out, unsigned frames)
+{
+    if (PASSES_SIZE == 0)
+        return;
+
+    out << std::fixed << std::setprecision(3) << "gpu pass  ms  max ms  (last " << frames << " results)\n";
+    for (unsigned i = 0; i < PASSES_SIZE; ++i)
+    {
+        auto& pass = PASSES[i];
+        for (unsigned slot = 0; slot < QUERIES; ++slot)
+        {
+            collect(pass, slot);
+        }
+
+        auto const count = std::min<unsigned long long>({frames, pass.m_results_written, RESULTS_SIZE});
+        if (count == 0)
+            continue;
+
+        unsigned long long total{};
+        unsigned long long max{};
+        for (unsigned long long r = pass.m_results_written - count; r < pass.m_results_written; ++r)
+        {
+            auto const elapsed = pass.m_results[r % RESULTS_SIZE];
+            total += elapsed;
+            max = std::max(max, elapsed);
+        }
+
+        out << "  " << pass.m_name << "  " << total / 1e6 / count << "  " << max / 1e6 << "\n";
+    }
+}
+
+#endif
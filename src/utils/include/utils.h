@@ -1,8 +1,10 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <cstdint>
 #include <string>
 #include <iostream>
+#include <vector>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -10,10 +12,24 @@
 
 int load_texture(std::string const& texture_file_path);
 
+// Returns texture at once, grey until image is decoded on worker thread
+// and uploaded by update_textures. Image and its mip chain are cached next
+// to it (<texture_file_path>.mips), later runs read cache instead of decoding.
+int load_texture_async(std::string const& texture_file_path);
+
+// uploads textures loaded since last call, once per frame
+void update_textures();
+
+// Program of shader files. Programs are shared by every shader built from
+// same sources, so uniforms have to be set before each use. Linked programs
+// are also kept in ./shader_cache, later runs load them without compiling.
+// Constructor does not wait for compiler, see poll_shaders.
 class shader
 {
 public:
 	shader(const char* vertex_path, const char* fragment_path, const char* geometry_path = nullptr);
+	// compute program (GL 4.3)
+	explicit shader(const char* compute_path);
 	
 	void use_program() const;
 
@@ -22,14 +38,28 @@ public:
 	void set_uniform(const char* uniform_name, unsigned i);
 	void set_uniform(const char* uniform_name, glm::mat4 const& m4);
 	void set_uniform(const char* uniform_name, glm::vec3 const& v3);
+	void set_uniform(const char* uniform_name, float const* f, unsigned count);
+	void set_uniform(const char* uniform_name, glm::vec4 const* v4, unsigned count);
 
 private:
+	struct stage
+	{
+		GLenum m_type;
+		const char* m_name;
+		std::string m_code;
+	};
+
 	unsigned m_program_id{};
+	unsigned program_of(stage const* stages, unsigned stages_size) const;
+	unsigned compile(std::uint64_t key, stage const* stages, unsigned stages_size) const;
 	std::string read_file(const char* file_path) const;
-	void check_compile_status(unsigned shader_id, std::string type) const;
-	void check_linking_status(unsigned program_id) const;
 };
 
+// Programs of constructed shaders are compiled in background by driver with
+// GL_KHR_parallel_shader_compile. Checks the finished ones, never waits,
+// returns how many are still building. Without extension all are finished at once.
+unsigned poll_shaders();
+
 class vertex_buffer
 {
 public:
@@ -45,10 +75,147 @@ public:
 	// example data : pos_x, pos_y, pos_z, color_x, color_y
 	// pattern		: "32"
 	void set_vertex_attrib_pointers(const char* const pattern);
+
+	// same pattern, attributes advance once per instance and start at location first_index,
+	// read from buffer bound to GL_ARRAY_BUFFER
+	void set_instance_attrib_pointers(unsigned first_index, const char* const pattern);
 private:
     unsigned m_vao{};
 };
 
+// array buffer for data appended over time, storage doubles when full
+// and keeps written data, so appending is O(1) amortized
+class growable_buffer
+{
+public:
+	explicit growable_buffer(unsigned capacity);
+
+	// leaves buffer bound to GL_ARRAY_BUFFER
+	void write(void const* const data, unsigned offset, unsigned size);
+
+private:
+	unsigned m_vbo{};
+	unsigned m_capacity{};
+	void grow(unsigned capacity, unsigned keep);
+};
+
+// shader storage buffer of instance models (GL 4.3)
+class model_buffer
+{
+public:
+	explicit model_buffer(unsigned capacity);
+
+	// models [first, first + count), e.g. range returned by calculate_models_*
+	void write(glm::mat4 const* models, unsigned first, unsigned count);
+	void bind(unsigned binding) const;
+
+private:
+	unsigned m_ssbo{};
+};
+
+// shader storage buffer of one unsigned per instance, e.g. its sprite (GL 4.3)
+class instance_buffer
+{
+public:
+	explicit instance_buffer(unsigned capacity);
+
+	void write(unsigned const* values, unsigned first, unsigned count);
+	void bind(unsigned binding) const;
+
+private:
+	unsigned m_ssbo{};
+};
+
+// Frustum culling and level of detail selection of instances in compute
+// shader (GL 4.3). Indices of visible instances and one indirect draw command
+// per glyph and level stay on GPU, CPU never touches per instance visibility.
+class gpu_culling
+{
+public:
+	gpu_culling(unsigned capacity, unsigned lods, unsigned glyphs);
+
+	// vertices drawn for glyph at level of detail
+	void set_glyph_lod(unsigned glyph, unsigned lod, unsigned first, unsigned count);
+
+	// lod_distances holds lods - 1 distances from camera where next level starts
+	void cull(model_buffer const& models, unsigned count, glm::mat4 const& view_projection,
+		glm::vec3 const& camera, float radius, float const* lod_distances);
+
+	// Draws visible instances of last cull with program reading
+	// models[visible[lod_offset + gl_InstanceID]] (instanced_vertex.txt),
+	// models can be other models of the same instances. VAO has to be bound.
+	void draw(shader& program, model_buffer const& models, GLenum mode, unsigned glyph, unsigned lod);
+
+private:
+	unsigned m_capacity{};
+	unsigned m_lods{};
+	unsigned m_glyphs{};
+	shader m_compute;
+	unsigned m_visible{};
+	unsigned m_counts{};
+	unsigned m_commands{};
+};
+
+// image of texture_atlas, pixels at m_x, m_y of layer, same as uv
+// min u, min v, max u, max v
+struct atlas_region
+{
+	unsigned m_layer;
+	unsigned m_x;
+	unsigned m_y;
+	unsigned m_width;
+	unsigned m_height;
+	glm::vec4 m_uv;
+};
+
+// Images packed into layers of one GL_TEXTURE_2D_ARRAY, instances looking
+// differently are drawn without texture rebinds, each one picks its region.
+// Regions are placed by skyline bottom left packing, layer after layer.
+class texture_atlas
+{
+public:
+	texture_atlas(unsigned size, unsigned layers);
+	~texture_atlas();
+
+	texture_atlas(texture_atlas const&) = delete;
+	texture_atlas& operator=(texture_atlas const&) = delete;
+
+	// false when image fits in no layer
+	bool add(unsigned char const* rgba, unsigned width, unsigned height, atlas_region& region);
+	bool add(std::string const& image_path, atlas_region& region);
+
+	// empty region to be drawn into between begin_render and end_render
+	bool allocate(unsigned width, unsigned height, atlas_region& region);
+
+	// draws go to region, until end_render restores framebuffer and viewport
+	void begin_render(atlas_region const& region);
+	void end_render();
+
+	// after regions are added, before drawing from atlas
+	void generate_mipmaps();
+	void bind(unsigned unit) const;
+
+private:
+	struct segment
+	{
+		unsigned m_x;
+		unsigned m_y;
+		unsigned m_width;
+	};
+
+	unsigned m_texture{};
+	unsigned m_size{};
+	unsigned m_layers{};
+	// top of used space per started layer
+	std::vector<std::vector<segment>> m_skylines;
+
+	unsigned m_framebuffer{};
+	int m_previous_framebuffer{};
+	int m_previous_viewport[4]{};
+
+	bool place(unsigned width, unsigned height, unsigned& layer, unsigned& x, unsigned& y);
+};
+
 class camera
 {
     public:
@@ -74,4 +241,69 @@ class camera
     glm::vec3 const m_camera_direction{ glm::normalize(glm::vec3{0.0f, 1.0f, -1.0f }) };
 };
 
+// Scoped zone profiler, built only with __PROFILE__ defined (cmake -DPROFILE=ON),
+// otherwise all macros expand to nothing.
+// Zones are timed with the cycle counter into a ring buffer per thread,
+// gpu zones with GL_TIME_ELAPSED queries read back frames later.
+#ifdef __PROFILE__
+
+class profile_zone
+{
+public:
+    explicit profile_zone(char const* name);
+    ~profile_zone();
+
+    profile_zone(profile_zone const&) = delete;
+    profile_zone& operator=(profile_zone const&) = delete;
+
+private:
+    char const* m_name;
+    unsigned long long m_begin;
+};
+
+// GPU time of GL commands issued in scope, main thread only.
+// Nested gpu zone is not timed on its own, its time goes to outer one.
+class gpu_zone
+{
+public:
+    explicit gpu_zone(char const* name);
+    ~gpu_zone();
+
+    gpu_zone(gpu_zone const&) = delete;
+    gpu_zone& operator=(gpu_zone const&) = delete;
+
+private:
+    unsigned m_query;
+};
+
+// closes frame, summary is averaged over frames
+void profile_frame();
+
+// zones still in ring buffers as chrome://tracing / Perfetto JSON,
+// call between frames, when no other thread records
+bool write_profile_trace(char const* file_name);
+
+// time per frame of every zone over the last frames
+void print_profile_summary(std::ostream& out, unsigned frames = 120);
+// average / worst GPU time of every gpu zone over the last results
+void print_gpu_summary(std::ostream& out, unsigned frames = 120);
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) profile_zone PROFILE_CONCAT(profile_zone_, __LINE__){name}
+#define PROFILE_GPU_ZONE(name) gpu_zone PROFILE_CONCAT(gpu_zone_, __LINE__){name}
+#define PROFILE_FRAME() profile_frame()
+#define PROFILE_WRITE_TRACE(file_name) write_profile_trace(file_name)
+#define PROFILE_PRINT_SUMMARY(out) (print_profile_summary(out), print_gpu_summary(out))
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_GPU_ZONE(name)
+#define PROFILE_FRAME()
+#define PROFILE_WRITE_TRACE(file_name)
+#define PROFILE_PRINT_SUMMARY(out)
+
+#endif
+
 #endif
\ No newline at end of file
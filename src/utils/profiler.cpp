@@ -0,0 +1,227 @@
+#ifdef __PROFILE__
+
+#include <utils.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace
+{
+    // zones per thread kept for export, older ones are overwritten
+    constexpr unsigned RING_SIZE = 1 << 14;
+    constexpr unsigned FRAMES_SIZE = 1024;
+
+    struct zone_event
+    {
+        char const* m_name;
+        unsigned long long m_begin;
+        unsigned long long m_end;
+        unsigned m_depth;
+    };
+
+    struct thread_ring
+    {
+        std::array<zone_event, RING_SIZE> m_events;
+        // events ever written, ring index is m_written % RING_SIZE
+        std::atomic<unsigned long long> m_written{};
+    };
+
+    unsigned long long ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    double now_us()
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // pair of clocks, ticks are converted to time against it
+    unsigned long long const START_TICKS = ticks();
+    double const START_US = now_us();
+
+    double ticks_per_us()
+    {
+        double const elapsed = now_us() - START_US;
+        return elapsed > 0.0 ? (ticks() - START_TICKS) / elapsed : 1.0;
+    }
+
+    // rings outlive their threads, thread spawned later reuses free one
+    std::mutex RINGS_MUTEX;
+    std::vector<std::unique_ptr<thread_ring>> RINGS;
+    std::vector<unsigned> FREE_RINGS;
+
+    struct ring_owner
+    {
+        unsigned m_index;
+        thread_ring* m_ring;
+        unsigned m_depth{};
+
+        ring_owner()
+        {
+            std::lock_guard lock{RINGS_MUTEX};
+            if (FREE_RINGS.empty())
+            {
+                m_index = unsigned(RINGS.size());
+                RINGS.push_back(std::make_unique<thread_ring>());
+            }
+            else
+            {
+                m_index = FREE_RINGS.back();
+                FREE_RINGS.pop_back();
+            }
+            m_ring = RINGS[m_index].get();
+        }
+
+        ~ring_owner()
+        {
+            std::lock_guard lock{RINGS_MUTEX};
+            FREE_RINGS.push_back(m_index);
+        }
+    };
+
+    thread_local ring_owner OWNER;
+
+    void record(char const* name, unsigned long long begin, unsigned long long end, unsigned depth)
+    {
+        auto& ring = *OWNER.m_ring;
+        auto const written = ring.m_written.load(std::memory_order_relaxed);
+        ring.m_events[written % RING_SIZE] = {name, begin, end, depth};
+        ring.m_written.store(written + 1, std::memory_order_release);
+    }
+
+    // start of every frame, last one is start of current frame
+    std::array<unsigned long long, FRAMES_SIZE> FRAMES;
+    unsigned long long FRAMES_WRITTEN{};
+
+    template <typename F>
+    void for_each_event(F f)
+    {
+        std::lock_guard lock{RINGS_MUTEX};
+        for (unsigned r = 0; r < RINGS.size(); ++r)
+        {
+            auto const& ring = *RINGS[r];
+            auto const written = ring.m_written.load(std::memory_order_acquire);
+            auto const first = written > RING_SIZE ? written - RING_SIZE : 0;
+            for (auto e = first; e < written; ++e)
+            {
+                f(r, ring.m_events[e % RING_SIZE]);
+            }
+        }
+    }
+} // Anonymous NS
+
+profile_zone::profile_zone(char const* name)
+:m_name{name},
+m_begin{ticks()}
+{
+    ++OWNER.m_depth;
+}
+
+profile_zone::~profile_zone()
+{
+    record(m_name, m_begin, ticks(), OWNER.m_depth--);
+}
+
+void profile_frame()
+{
+    auto const now = ticks();
+    if (FRAMES_WRITTEN > 0)
+    {
+        record("frame", FRAMES[(FRAMES_WRITTEN - 1) % FRAMES_SIZE], now, 0);
+    }
+    FRAMES[FRAMES_WRITTEN++ % FRAMES_SIZE] = now;
+}
+
+bool write_profile_trace(char const* file_name)
+{
+    std::ofstream file(file_name);
+    if (!file)
+        return false;
+
+    double const scale = 1.0 / ticks_per_us();
+    bool first = true;
+
+    file << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    for_each_event([&](unsigned thread, zone_event const& e)
+    {
+        file << (first ? "" : ",\n")
+             << "{\"name\":\"" << e.m_name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread
+             << ",\"ts\":" << (e.m_begin - START_TICKS) * scale
+             << ",\"dur\":" << (e.m_end - e.m_begin) * scale << "}";
+        first = false;
+    });
+    file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    return bool(file);
+}
+
+void print_profile_summary(std::ostream& out, unsigned frames)
+{
+    frames = std::min<unsigned long long>({frames, FRAMES_WRITTEN, FRAMES_SIZE});
+    if (frames < 2)
+        return;
+
+    // complete frames only, current one is still running
+    auto const window_begin = FRAMES[(FRAMES_WRITTEN - frames) % FRAMES_SIZE];
+    auto const window_end = FRAMES[(FRAMES_WRITTEN - 1) % FRAMES_SIZE];
+    double const frame_count = frames - 1;
+
+    struct zone_stats
+    {
+        unsigned long long m_first;
+        unsigned long long m_total;
+        unsigned long long m_max;
+        unsigned m_calls;
+        unsigned m_depth;
+    };
+    std::map<std::string_view, zone_stats> stats;
+
+    for_each_event([&](unsigned, zone_event const& e)
+    {
+        if (e.m_begin < window_begin || e.m_end > window_end)
+            return;
+
+        auto const duration = e.m_end - e.m_begin;
+        auto& s = stats.try_emplace(e.m_name, zone_stats{e.m_begin, 0, 0, 0, e.m_depth}).first->second;
+        s.m_first = std::min(s.m_first, e.m_begin);
+        s.m_total += duration;
+        s.m_max = std::max(s.m_max, duration);
+        s.m_calls++;
+        s.m_depth = std::min(s.m_depth, e.m_depth);
+    });
+
+    // parents start before their children
+    std::vector<std::pair<std::string_view, zone_stats>> sorted(stats.begin(), stats.end());
+    std::sort(sorted.begin(), sorted.end(), [](auto const& a, auto const& b)
+              { return a.second.m_first < b.second.m_first; });
+
+    double const ms = 1.0 / (1000.0 * ticks_per_us());
+    out << std::fixed << std::setprecision(3)
+        << "zone  ms/frame  calls/frame  max ms  (" << frames - 1 << " frames)\n";
+    for (auto const& [name, s] : sorted)
+    {
+        out << std::string(2 * s.m_depth, ' ') << name
+            << "  " << s.m_total * ms / frame_count
+            << "  " << s.m_calls / frame_count
+            << "  " << s.m_max * ms << "\n";
+    }
+}
+
+#endif
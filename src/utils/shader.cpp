@@ -2,51 +2,344 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <unordered_map>
+#include <vector>
 #include <glm/gtc/type_ptr.hpp>
 
+namespace
+{
+	// linked binaries are kept there between runs, file per program
+	char const* const BINARY_CACHE_DIRECTORY = "./shader_cache";
+	constexpr char BINARY_MAGIC[4] = {'M', 'P', 'R', 'G'};
+
+	struct binary_header
+	{
+		char m_magic[4];
+		std::uint32_t m_format;
+		std::uint32_t m_size;
+	};
+
+	// programs of this run by hash of their sources
+	std::unordered_map<std::uint64_t, unsigned> PROGRAMS;
+
+	// program linked, but its status not checked yet
+	struct building_program
+	{
+		std::uint64_t m_key;
+		unsigned m_program_id;
+		std::array<unsigned, 3> m_shader_ids;
+		std::array<const char*, 3> m_names;
+		unsigned m_stages_size;
+	};
+
+	std::vector<building_program> BUILDING;
+
+	// FNV-1a
+	std::uint64_t hash(std::uint64_t h, void const* data, std::size_t size)
+	{
+		auto const bytes = static_cast<unsigned char const*>(data);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			h = (h ^ bytes[i]) * 0x100000001b3ull;
+		}
+		return h;
+	}
+
+	std::uint64_t hash(std::uint64_t h, char const* text)
+	{
+		return hash(h, text, std::strlen(text) + 1);
+	}
+
+	// binary is valid only for driver which made it
+	std::uint64_t driver_hash()
+	{
+		std::uint64_t h = 0xcbf29ce484222325ull;
+		h = hash(h, reinterpret_cast<char const*>(glGetString(GL_VENDOR)));
+		h = hash(h, reinterpret_cast<char const*>(glGetString(GL_RENDERER)));
+		return hash(h, reinterpret_cast<char const*>(glGetString(GL_VERSION)));
+	}
+
+	bool binaries_supported()
+	{
+		static bool const supported = [] {
+			// core since GL 4.1
+			int major{}, minor{};
+			glGetIntegerv(GL_MAJOR_VERSION, &major);
+			glGetIntegerv(GL_MINOR_VERSION, &minor);
+			if (!GLAD_GL_ARB_get_program_binary && major * 10 + minor < 41)
+				return false;
+
+			int formats{};
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			return formats > 0;
+		}();
+		return supported;
+	}
+
+	std::string binary_path(std::uint64_t key)
+	{
+		std::ostringstream path;
+		path << BINARY_CACHE_DIRECTORY << "/" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+		return path.str();
+	}
+
+	// 0 when there is no binary, or driver refuses it
+	unsigned load_binary(std::uint64_t key)
+	{
+		std::ifstream file(binary_path(key), std::ios::binary | std::ios::ate);
+		auto const file_size = std::streamoff(file.tellg());
+		file.seekg(0);
+
+		binary_header header{};
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+			std::memcmp(header.m_magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0)
+			return 0;
+
+		// corrupt size, not allocated
+		if (header.m_size > file_size - std::streamoff(sizeof(header)))
+			return 0;
+
+		std::vector<char> binary(header.m_size);
+		if (!file.read(binary.data(), binary.size()))
+			return 0;
+
+		unsigned const program_id = glCreateProgram();
+		glProgramBinary(program_id, header.m_format, binary.data(), binary.size());
+
+		int success{};
+		glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			glDeleteProgram(program_id);
+			return 0;
+		}
+		return program_id;
+	}
+
+	bool check_compile_status(unsigned shader_id, std::string type)
+	{
+		int success{};
+		glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			std::array<char, 512> infoLog;
+			glGetShaderInfoLog(shader_id, static_cast<GLsizei>(infoLog.size()), NULL, infoLog.data());
+			std::cout << "ERROR::SHADER::"<<type<<"::COMPILATION_FAILED\n" << infoLog.data() << "\n";
+		};
+		return success;
+	}
+
+	void check_linking_status(unsigned program_id)
+	{
+		int success{};
+		glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			std::array<char, 512> infoLog;
+			glGetProgramInfoLog(program_id, static_cast<GLsizei>(infoLog.size()), NULL, infoLog.data());
+			std::cout << "ERROR::PROGRAM_LINKING_ERROR::" << infoLog.data() << "\n";
+		}
+	}
+
+	// GL_KHR_parallel_shader_compile, or same ARB extension
+	bool parallel_compile()
+	{
+		static bool const parallel = [] {
+			if (GLAD_GL_KHR_parallel_shader_compile)
+				glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+			else if (GLAD_GL_ARB_parallel_shader_compile)
+				glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+			return GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile;
+		}();
+		return parallel;
+	}
+
+	// without extension status query is what waits for compiler
+	bool completed(building_program const& program)
+	{
+		if (!parallel_compile())
+			return true;
+
+		int completed{};
+		glGetProgramiv(program.m_program_id, GL_COMPLETION_STATUS_KHR, &completed);
+		return completed;
+	}
+
+	void save_binary(std::uint64_t key, unsigned program_id)
+	{
+		int size{};
+		glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &size);
+		if (size <= 0)
+			return;
+
+		binary_header header{};
+		std::memcpy(header.m_magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+		std::vector<char> binary(size);
+		GLenum format{};
+		glGetProgramBinary(program_id, size, nullptr, &format, binary.data());
+		header.m_format = format;
+		header.m_size = size;
+
+		std::error_code error;
+		std::filesystem::create_directories(BINARY_CACHE_DIRECTORY, error);
+
+		// written aside and renamed, so other run never reads half written binary
+		auto const path = binary_path(key);
+		auto const temporary = path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary);
+			file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+			file.write(binary.data(), binary.size());
+			if (!file)
+				return;
+		}
+		std::filesystem::rename(temporary, path, error);
+	}
+
+	// program has to be out of BUILDING already
+	void finish(building_program const& program)
+	{
+		bool compiled = true;
+		for (unsigned i = 0; i < program.m_stages_size; ++i)
+		{
+			compiled &= check_compile_status(program.m_shader_ids[i], program.m_names[i]);
+		}
+		if (compiled)
+			check_linking_status(program.m_program_id);
+
+		for (unsigned i = 0; i < program.m_stages_size; ++i)
+		{
+			glDeleteShader(program.m_shader_ids[i]);
+		}
+
+		if (!compiled)
+			throw std::runtime_error("Cannot compile shader\n");
+
+		if (binaries_supported())
+			save_binary(program.m_key, program.m_program_id);
+	}
+} // Anonymous NS
+
+unsigned poll_shaders()
+{
+	// one program at a time, when check of one throws the others stay building
+	for (unsigned i = 0; i < BUILDING.size();)
+	{
+		if (!completed(BUILDING[i]))
+		{
+			++i;
+			continue;
+		}
+
+		building_program const program = BUILDING[i];
+		BUILDING.erase(BUILDING.begin() + i);
+		finish(program);
+	}
+
+	return unsigned(BUILDING.size());
+}
+
 shader::shader(const char* vertex_path, const char* fragment_path, const char* geometry_path)
 {
-	std::string vertex_code{ read_file(vertex_path) };
-	char const* vc = vertex_code.data();
-	unsigned vertex_id = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex_id, 1, &vc, NULL);
-	glCompileShader(vertex_id);
-	check_compile_status(vertex_id, "VERTEX");
-
-	std::string fragment_code{ read_file(fragment_path) };
-	char const* fc = fragment_code.data();
-	unsigned fragment_id = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment_id, 1, &fc, NULL);
-	glCompileShader(fragment_id);
-	check_compile_status(fragment_id, "FRAGMENT");
-
-	m_program_id = glCreateProgram();
-	glAttachShader(m_program_id, vertex_id);
-	glAttachShader(m_program_id, fragment_id);
+	std::array<stage, 3> stages{ {
+		{ GL_VERTEX_SHADER, "VERTEX", read_file(vertex_path) },
+		{ GL_FRAGMENT_SHADER, "FRAGMENT", read_file(fragment_path) } } };
+	unsigned stages_size = 2;
 
 	if (geometry_path)
 	{
-		std::string fragment_code{ read_file(geometry_path) };
-		char const* fc = fragment_code.data();
-		unsigned geometry_id = glCreateShader(GL_GEOMETRY_SHADER);
-		glShaderSource(geometry_id, 1, &fc, NULL);
-		glCompileShader(geometry_id);
-		check_compile_status(geometry_id, "GEOMETRY");
-		glAttachShader(m_program_id, geometry_id);
+		stages[stages_size++] = { GL_GEOMETRY_SHADER, "GEOMETRY", read_file(geometry_path) };
+	}
+
+	m_program_id = program_of(stages.data(), stages_size);
+}
+
+shader::shader(const char* compute_path)
+{
+	stage const compute{ GL_COMPUTE_SHADER, "COMPUTE", read_file(compute_path) };
+
+	m_program_id = program_of(&compute, 1);
+}
+
+// Same sources give same program, from this run, binary of earlier run or compiled.
+unsigned shader::program_of(stage const* stages, unsigned stages_size) const
+{
+	static std::uint64_t const driver = driver_hash();
+
+	std::uint64_t key = driver;
+	for (unsigned i = 0; i < stages_size; ++i)
+	{
+		key = hash(key, &stages[i].m_type, sizeof(stages[i].m_type));
+		key = hash(key, stages[i].m_code.c_str());
 	}
 
-	glLinkProgram(m_program_id);
-	check_linking_status(m_program_id);
+	if (auto const found = PROGRAMS.find(key); found != PROGRAMS.end())
+		return found->second;
 
-	glDeleteShader(vertex_id);
-	glDeleteShader(fragment_id);
+	unsigned program_id = binaries_supported() ? load_binary(key) : 0;
+	if (program_id == 0)
+	{
+		program_id = compile(key, stages, stages_size);
+	}
 
-	use_program();
+	PROGRAMS.emplace(key, program_id);
+	return program_id;
+}
+
+// Compile and link are only submitted, status is checked once driver
+// is done (poll_shaders) or when program is used first.
+unsigned shader::compile(std::uint64_t key, stage const* stages, unsigned stages_size) const
+{
+	building_program program{ key, 0, {}, {}, stages_size };
+	parallel_compile();
+
+	for (unsigned i = 0; i < stages_size; ++i)
+	{
+		char const* code = stages[i].m_code.data();
+		program.m_shader_ids[i] = glCreateShader(stages[i].m_type);
+		program.m_names[i] = stages[i].m_name;
+		glShaderSource(program.m_shader_ids[i], 1, &code, NULL);
+		glCompileShader(program.m_shader_ids[i]);
+	}
+
+	program.m_program_id = glCreateProgram();
+	for (unsigned i = 0; i < stages_size; ++i)
+	{
+		glAttachShader(program.m_program_id, program.m_shader_ids[i]);
+	}
+
+	if (binaries_supported())
+		glProgramParameteri(program.m_program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+	glLinkProgram(program.m_program_id);
+
+	BUILDING.push_back(program);
+	return program.m_program_id;
 }
 
 void shader::use_program() const
 {
+	// still building, waits for it
+	if (!BUILDING.empty())
+	{
+		auto const found = std::find_if(BUILDING.begin(), BUILDING.end(), [this](building_program const& program)
+		{
+			return program.m_program_id == m_program_id;
+		});
+		if (found != BUILDING.end())
+		{
+			building_program const program = *found;
+			BUILDING.erase(found);
+			finish(program);
+		}
+	}
+
 	glUseProgram(m_program_id);
 }
 
@@ -80,6 +373,18 @@ void shader::set_uniform(const char* uniform_name, glm::vec3 const& v3)
 	glUniform3fv(loc, 1, &v3[0]);
 }
 
+void shader::set_uniform(const char* uniform_name, float const* f, unsigned count)
+{
+	const int loc = glGetUniformLocation(m_program_id, uniform_name);
+	glUniform1fv(loc, count, f);
+}
+
+void shader::set_uniform(const char* uniform_name, glm::vec4 const* v4, unsigned count)
+{
+	const int loc = glGetUniformLocation(m_program_id, uniform_name);
+	glUniform4fv(loc, count, &v4[0][0]);
+}
+
 std::string shader::read_file(const char* path) const
 {
 	std::ifstream file(path);
@@ -89,28 +394,3 @@ std::string shader::read_file(const char* path) const
 	if (str.empty()) throw std::runtime_error("File is empty");
 	return str;
 }
-
-void shader::check_compile_status(unsigned shader_id, std::string type) const
-{
-	int success{};
-	glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
-	if (!success)
-	{
-		std::array<char, 512> infoLog;
-		glGetShaderInfoLog(shader_id, static_cast<GLsizei>(infoLog.size()), NULL, infoLog.data());
-		std::cout << "ERROR::SHADER::"<<type<<"::COMPILATION_FAILED\n" << infoLog.data() << "\n";
-		throw std::runtime_error("Cannot compile shader\n");
-	};
-}
-
-void shader::check_linking_status(unsigned program_id) const
-{
-	int success{};
-	glGetProgramiv(program_id, GL_LINK_STATUS, &success);
-	if (!success)
-	{
-		std::array<char, 512> infoLog;
-		glGetProgramInfoLog(program_id, static_cast<GLsizei>(infoLog.size()), NULL, infoLog.data());
-		std::cout << "ERROR::PROGRAM_LINKING_ERROR::" << infoLog.data() << "\n";
-	}
-}
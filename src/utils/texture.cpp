@@ -1,33 +1,326 @@
 #include <utils.h>
 #include <stb_image.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// cache file next to image: header, then levels tightly packed, largest first
+	struct mip_header
+	{
+		char m_magic[4];
+		std::uint32_t m_version;
+		// source image it was made from, cache is stale when they differ
+		std::uint64_t m_source_size;
+		std::int64_t m_source_time;
+		std::uint32_t m_width;
+		std::uint32_t m_height;
+		std::uint32_t m_channels;
+		std::uint32_t m_levels;
+	};
+
+	constexpr char MIP_MAGIC[4] = {'M', 'M', 'I', 'P'};
+	constexpr std::uint32_t MIP_VERSION = 1;
+
+	struct mip_chain
+	{
+		unsigned m_width{};
+		unsigned m_height{};
+		unsigned m_channels{};
+		unsigned m_levels{};
+		std::vector<unsigned char> m_data;
+	};
+
+	std::size_t level_size(mip_chain const& image, unsigned level)
+	{
+		return std::size_t(std::max(image.m_width >> level, 1u)) * std::max(image.m_height >> level, 1u) * image.m_channels;
+	}
+
+	// full chain, down to 1 x 1
+	unsigned levels_of(unsigned width, unsigned height)
+	{
+		unsigned levels = 1;
+		while ((width >> levels) > 0 || (height >> levels) > 0)
+		{
+			++levels;
+		}
+		return levels;
+	}
+
+	std::string cache_path(std::string const& texture_file_path)
+	{
+		return texture_file_path + ".mips";
+	}
+
+	mip_header source_header(std::string const& texture_file_path)
+	{
+		std::error_code error;
+		mip_header header{};
+		std::memcpy(header.m_magic, MIP_MAGIC, sizeof(MIP_MAGIC));
+		header.m_version = MIP_VERSION;
+		header.m_source_size = std::filesystem::file_size(texture_file_path, error);
+		header.m_source_time = std::filesystem::last_write_time(texture_file_path, error).time_since_epoch().count();
+		return header;
+	}
+
+	bool read_cache(std::string const& texture_file_path, mip_chain& image)
+	{
+		std::ifstream file(cache_path(texture_file_path), std::ios::binary | std::ios::ate);
+		std::streamoff const file_size = file.tellg();
+		file.seekg(0);
+		mip_header header{};
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+			return false;
+
+		auto const source = source_header(texture_file_path);
+		if (std::memcmp(header.m_magic, MIP_MAGIC, sizeof(MIP_MAGIC)) != 0 || header.m_version != MIP_VERSION ||
+			header.m_source_size != source.m_source_size || header.m_source_time != source.m_source_time)
+			return false;
+
+		// damaged cache is stale too, image is decoded again
+		if (header.m_width == 0 || header.m_height == 0 || header.m_channels < 1 || header.m_channels > 4 ||
+			header.m_levels != levels_of(header.m_width, header.m_height))
+			return false;
+
+		image.m_width = header.m_width;
+		image.m_height = header.m_height;
+		image.m_channels = header.m_channels;
+		image.m_levels = header.m_levels;
+
+		std::size_t size = 0;
+		for (unsigned level = 0; level < image.m_levels; ++level)
+		{
+			size += level_size(image, level);
+		}
+		if (size != std::size_t(file_size) - sizeof(header))
+			return false;
+		image.m_data.resize(size);
+		return bool(file.read(reinterpret_cast<char*>(image.m_data.data()), size));
+	}
+
+	void write_cache(std::string const& texture_file_path, mip_chain const& image)
+	{
+		auto header = source_header(texture_file_path);
+		header.m_width = image.m_width;
+		header.m_height = image.m_height;
+		header.m_channels = image.m_channels;
+		header.m_levels = image.m_levels;
+
+		// written aside and renamed, so other run never reads half written cache
+		auto const path = cache_path(texture_file_path);
+		auto const temporary = path + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary);
+			file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+			file.write(reinterpret_cast<char const*>(image.m_data.data()), image.m_data.size());
+			if (!file)
+				return;
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+	}
+
+	// 2 x 2 box filter of every level from the one above, down to 1 x 1
+	void generate_mips(mip_chain& image)
+	{
+		unsigned const channels = image.m_channels;
+		image.m_levels = levels_of(image.m_width, image.m_height);
+		std::size_t size = 0;
+		for (unsigned level = 0; level < image.m_levels; ++level)
+		{
+			size += level_size(image, level);
+		}
+		image.m_data.resize(size);
+
+		std::size_t src = 0;
+		for (unsigned level = 1; level < image.m_levels; ++level)
+		{
+			unsigned const src_width = std::max(image.m_width >> (level - 1), 1u);
+			unsigned const src_height = std::max(image.m_height >> (level - 1), 1u);
+			unsigned const width = std::max(image.m_width >> level, 1u);
+			unsigned const height = std::max(image.m_height >> level, 1u);
+			std::size_t const dst = src + level_size(image, level - 1);
+			auto const texel = [&](unsigned x, unsigned y, unsigned c)
+			{ return unsigned(image.m_data[src + (y * src_width + x) * channels + c]); };
+
+			for (unsigned y = 0; y < height; ++y)
+			{
+				// odd sizes repeat last row / column
+				unsigned const y0 = std::min(2 * y, src_height - 1);
+				unsigned const y1 = std::min(2 * y + 1, src_height - 1);
+				for (unsigned x = 0; x < width; ++x)
+				{
+					unsigned const x0 = std::min(2 * x, src_width - 1);
+					unsigned const x1 = std::min(2 * x + 1, src_width - 1);
+					for (unsigned c = 0; c < channels; ++c)
+					{
+						unsigned const sum = texel(x0, y0, c) + texel(x1, y0, c) + texel(x0, y1, c) + texel(x1, y1, c);
+						image.m_data[dst + (y * width + x) * channels + c] = static_cast<unsigned char>((sum + 2) / 4);
+					}
+				}
+			}
+			src = dst;
+		}
+	}
+
+	// cached mip chain, or decoded image and its mips written to cache
+	bool load_mip_chain(std::string const& texture_file_path, mip_chain& image)
+	{
+		if (read_cache(texture_file_path, image))
+			return true;
+
+		int width, height, nr_channels;
+		unsigned char* data = stbi_load(texture_file_path.c_str(), &width, &height, &nr_channels, 0);
+		if (!data)
+			return false;
+
+		image.m_width = width;
+		image.m_height = height;
+		image.m_channels = nr_channels;
+		image.m_data.assign(data, data + width * height * nr_channels);
+		stbi_image_free(data);
+
+		generate_mips(image);
+		write_cache(texture_file_path, image);
+		return true;
+	}
+
+	GLenum format_of(unsigned channels)
+	{
+		switch (channels)
+		{
+		case 1: return GL_RED;
+		case 2: return GL_RG;
+		case 3: return GL_RGB;
+		default: return GL_RGBA;
+		}
+	}
+
+	void set_texture_parameters()
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+
+	// all levels in one pixel buffer, texture reads them from it on GPU timeline
+	void upload(unsigned texture_id, mip_chain const& image)
+	{
+		unsigned pbo;
+		glGenBuffers(1, &pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, image.m_data.size(), nullptr, GL_STREAM_DRAW);
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, image.m_data.size(), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		std::memcpy(mapped, image.m_data.data(), image.m_data.size());
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		int alignment;
+		glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+		glBindTexture(GL_TEXTURE_2D, texture_id);
+		GLenum const format = format_of(image.m_channels);
+		std::size_t offset = 0;
+		for (unsigned level = 0; level < image.m_levels; ++level)
+		{
+			glTexImage2D(GL_TEXTURE_2D, level, format, std::max(image.m_width >> level, 1u), std::max(image.m_height >> level, 1u),
+						 0, format, GL_UNSIGNED_BYTE, reinterpret_cast<void const*>(offset));
+			offset += level_size(image, level);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.m_levels - 1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		// storage is released once GPU is done with it
+		glDeleteBuffers(1, &pbo);
+	}
+
+	struct texture_job
+	{
+		unsigned m_texture_id;
+		std::string m_path;
+		mip_chain m_image;
+		bool m_loaded{};
+		std::atomic<bool> m_done{};
+		std::thread m_worker;
+
+		~texture_job()
+		{
+			if (m_worker.joinable())
+				m_worker.join();
+		}
+	};
+
+	// loads in flight, main thread only
+	std::vector<std::unique_ptr<texture_job>> JOBS;
+} // Anonymous NS
 
 int load_texture(std::string const& texture_file_path)
 {
+	mip_chain image;
+	if (!load_mip_chain(texture_file_path, image))
+	{
+		std::cout << "Could not load texture at location: " << texture_file_path << "\n";
+		return -1;
+	}
+
 	unsigned texture_id;
 	glGenTextures(1, &texture_id);
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	set_texture_parameters();
 
+	upload(texture_id, image);
+	return texture_id;
+}
+
+int load_texture_async(std::string const& texture_file_path)
+{
+	unsigned texture_id;
+	glGenTextures(1, &texture_id);
 	glBindTexture(GL_TEXTURE_2D, texture_id);
+	set_texture_parameters();
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	// grey until image arrives
+	unsigned char const placeholder[4] = {128, 128, 128, 255};
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	auto& job = *JOBS.emplace_back(std::make_unique<texture_job>());
+	job.m_texture_id = texture_id;
+	job.m_path = texture_file_path;
+	job.m_worker = std::thread([&job]
+	{
+		job.m_loaded = load_mip_chain(job.m_path, job.m_image);
+		job.m_done.store(true, std::memory_order_release);
+	});
 
-	int width, height, nr_channels;
-	unsigned char* data = stbi_load(texture_file_path.c_str(), &width, &height, &nr_channels, 0);
+	return texture_id;
+}
 
-	if (data) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, nr_channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+void update_textures()
+{
+	for (auto& job : JOBS)
+	{
+		if (!job->m_done.load(std::memory_order_acquire))
+			continue;
+
+		job->m_worker.join();
+		if (job->m_loaded)
+			upload(job->m_texture_id, job->m_image);
+		else
+			std::cout << "Could not load texture at location: " << job->m_path << "\n";
+		job.reset();
 	}
-	else
-    {
-        std::cout << "Could not load texture at location: " << texture_file_path <<"\n";
-        return -1;
-    }
-		
-	glBindTexture(GL_TEXTURE_2D, 0);
-	stbi_image_free(data);
-	return texture_id;
-}
\ No newline at end of file
+	std::erase(JOBS, nullptr);
+}
@@ -0,0 +1,220 @@
+#include <utils.h>
+#include <stb_image.h>
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace
+{
+    // gap around every region, lower mip levels of neighbours do not bleed into it
+    constexpr unsigned PADDING = 2;
+
+    unsigned levels_of(unsigned size)
+    {
+        unsigned levels = 1;
+        while (size >> levels)
+        {
+            ++levels;
+        }
+        return levels;
+    }
+} // Anonymous NS
+
+texture_atlas::texture_atlas(unsigned size, unsigned layers)
+:m_size{size},
+m_layers{layers}
+{
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    // transparent, free space stays empty
+    std::vector<unsigned char> const zeros(size * size * layers * 4);
+    unsigned const levels = levels_of(size);
+    for (unsigned level = 0; level < levels; ++level)
+    {
+        unsigned const level_size = std::max(size >> level, 1u);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, level_size, level_size, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, zeros.data());
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    m_skylines.push_back({{0, 0, size}});
+}
+
+texture_atlas::~texture_atlas()
+{
+    glDeleteTextures(1, &m_texture);
+    if (m_framebuffer)
+        glDeleteFramebuffers(1, &m_framebuffer);
+}
+
+// Skyline bottom left: top edge of used space of layer is list of
+// horizontal segments, image goes where its top ends lowest.
+bool texture_atlas::place(unsigned width, unsigned height, unsigned& layer, unsigned& x, unsigned& y)
+{
+    width += 2 * PADDING;
+    height += 2 * PADDING;
+    if (width > m_size || height > m_size)
+        return false;
+
+    for (layer = 0; layer < m_layers; ++layer)
+    {
+        if (layer == m_skylines.size())
+            m_skylines.push_back({{0, 0, m_size}});
+
+        auto& skyline = m_skylines[layer];
+
+        unsigned best = unsigned(skyline.size());
+        unsigned best_top = m_size + 1;
+        for (unsigned i = 0; i < skyline.size(); ++i)
+        {
+            if (skyline[i].m_x + width > m_size)
+                break;
+
+            // image rests on highest segment it spans
+            unsigned top = 0;
+            for (unsigned j = i, covered = 0; covered < width; covered += skyline[j].m_width, ++j)
+            {
+                top = std::max(top, skyline[j].m_y);
+            }
+
+            if (top + height <= m_size && top + height < best_top)
+            {
+                best = i;
+                best_top = top + height;
+            }
+        }
+
+        if (best == skyline.size())
+            continue;
+
+        x = skyline[best].m_x;
+        y = best_top - height;
+
+        // new segment on top of image, segments under it are cut or removed
+        unsigned const end = x + width;
+        skyline.insert(skyline.begin() + best, segment{x, best_top, width});
+        for (unsigned i = best + 1; i < skyline.size() && skyline[i].m_x < end;)
+        {
+            unsigned const segment_end = skyline[i].m_x + skyline[i].m_width;
+            if (segment_end <= end)
+            {
+                skyline.erase(skyline.begin() + i);
+                continue;
+            }
+            skyline[i].m_width = segment_end - end;
+            skyline[i].m_x = end;
+            break;
+        }
+
+        // neighbours of same height are one segment
+        for (unsigned i = 0; i + 1 < skyline.size();)
+        {
+            if (skyline[i].m_y == skyline[i + 1].m_y)
+            {
+                skyline[i].m_width += skyline[i + 1].m_width;
+                skyline.erase(skyline.begin() + i + 1);
+                continue;
+            }
+            ++i;
+        }
+
+        x += PADDING;
+        y += PADDING;
+        return true;
+    }
+
+    return false;
+}
+
+bool texture_atlas::allocate(unsigned width, unsigned height, atlas_region& region)
+{
+    unsigned layer, x, y;
+    if (!place(width, height, layer, x, y))
+        return false;
+
+    float const scale = 1.0f / m_size;
+    region.m_layer = layer;
+    region.m_x = x;
+    region.m_y = y;
+    region.m_width = width;
+    region.m_height = height;
+    region.m_uv = glm::vec4{x * scale, y * scale, (x + width) * scale, (y + height) * scale};
+    return true;
+}
+
+bool texture_atlas::add(unsigned char const* rgba, unsigned width, unsigned height, atlas_region& region)
+{
+    if (!allocate(width, height, region))
+        return false;
+
+    int alignment;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, region.m_x, region.m_y, region.m_layer, width, height, 1,
+        GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+    return true;
+}
+
+bool texture_atlas::add(std::string const& image_path, atlas_region& region)
+{
+    int width, height, nr_channels;
+    unsigned char* data = stbi_load(image_path.c_str(), &width, &height, &nr_channels, 4);
+    if (!data)
+    {
+        std::cout << "Could not load texture at location: " << image_path << "\n";
+        return false;
+    }
+
+    bool const added = add(data, width, height, region);
+    stbi_image_free(data);
+    return added;
+}
+
+void texture_atlas::begin_render(atlas_region const& region)
+{
+    if (!m_framebuffer)
+        glGenFramebuffers(1, &m_framebuffer);
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previous_framebuffer);
+    glGetIntegerv(GL_VIEWPORT, m_previous_viewport);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+    glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_texture, 0, region.m_layer);
+
+    // wide points and lines reach past viewport
+    glViewport(region.m_x, region.m_y, region.m_width, region.m_height);
+    glScissor(region.m_x, region.m_y, region.m_width, region.m_height);
+    glEnable(GL_SCISSOR_TEST);
+}
+
+void texture_atlas::end_render()
+{
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_previous_framebuffer);
+    glViewport(m_previous_viewport[0], m_previous_viewport[1], m_previous_viewport[2], m_previous_viewport[3]);
+}
+
+void texture_atlas::generate_mipmaps()
+{
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void texture_atlas::bind(unsigned unit) const
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_texture);
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -1,4 +1,5 @@
 #include <utils.h>
+#include <algorithm>
 
 vertex_buffer::vertex_buffer()
 {
@@ -27,26 +28,84 @@ void vertex_buffer::bind_vao()
     glBindVertexArray(m_vao);
 }
 
+namespace
+{
+    void set_attrib_pointers(unsigned first_index, const char* pattern, unsigned divisor)
+    {
+        unsigned stride{};
+        const char* cc = pattern;
+        while (*cc)
+        {
+            stride += *cc - '0';
+            ++cc;
+        }
+
+        unsigned index{first_index};
+        unsigned offset{};
+        for (const char* pc = pattern; *pc != 0; ++pc)
+        {
+            const unsigned number = *pc - '0';
+
+            glVertexAttribPointer(index, number, GL_FLOAT, GL_FALSE,
+                stride * sizeof(float), (void*)(offset * sizeof(float)));
+            glEnableVertexAttribArray(index);
+            glVertexAttribDivisor(index, divisor);
+            ++index;
+            offset += number;
+        }
+    }
+} // Anonymous NS
+
 void vertex_buffer::set_vertex_attrib_pointers(const char* pattern)
 {
-    unsigned stride{};
-    const char* cc = pattern;
-    while (*cc)
+    set_attrib_pointers(0, pattern, 0);
+}
+
+void vertex_buffer::set_instance_attrib_pointers(unsigned first_index, const char* pattern)
+{
+    set_attrib_pointers(first_index, pattern, 1);
+}
+
+growable_buffer::growable_buffer(unsigned capacity)
+:m_capacity{capacity}
+{
+    glGenBuffers(1, &m_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferData(GL_ARRAY_BUFFER, m_capacity, nullptr, GL_DYNAMIC_DRAW);
+}
+
+void growable_buffer::write(void const* const data, unsigned offset, unsigned size)
+{
+    if (offset + size > m_capacity)
     {
-        stride += *cc - '0';
-        ++cc;
+        grow(std::max(2 * m_capacity, offset + size), offset);
     }
 
-    unsigned index{};
-    unsigned offset{};
-    for (const char* pc = pattern; *pc != 0; ++pc)
+    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+}
+
+// same buffer name is reallocated, VAOs pointing to it stay valid,
+// first keep bytes survive through temporary copy on GPU
+void growable_buffer::grow(unsigned capacity, unsigned keep)
+{
+    unsigned copy{};
+    if (keep > 0)
     {
-        const unsigned number = *pc - '0';
+        glGenBuffers(1, &copy);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, copy);
+        glBufferData(GL_COPY_WRITE_BUFFER, keep, nullptr, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, m_vbo);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, keep);
+    }
 
-        glVertexAttribPointer(index, number, GL_FLOAT, GL_FALSE,
-            stride * sizeof(float), (void*)(offset * sizeof(float)));
-        glEnableVertexAttribArray(index);
-        ++index;
-        offset += number;
+    glBindBuffer(GL_COPY_READ_BUFFER, m_vbo);
+    glBufferData(GL_COPY_READ_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+    m_capacity = capacity;
+
+    if (keep > 0)
+    {
+        glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, 0, keep);
+        glDeleteBuffers(1, &copy);
     }
 }